@@ -1,6 +1,7 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
 #include <asm-generic/uaccess.h>
@@ -21,14 +22,28 @@ typedef struct list_item {
 
 struct list_head mylist; /* Lista enlazada. OJO todos los demás nodos están en memoria dinámica. */
 
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
+static int modlist_open(struct inode *inode, struct file *file);
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos);
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos);
+static void modlist_seq_stop(struct seq_file *m, void *v);
+static int modlist_seq_show(struct seq_file *m, void *v);
 static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off);
 static void modlist_add(char *str);
 static void modlist_remove(char *str);
 static void modlist_cleanup(void);
 
+static const struct seq_operations modlist_seq_ops = {
+    .start = modlist_seq_start,
+    .next = modlist_seq_next,
+    .stop = modlist_seq_stop,
+    .show = modlist_seq_show,
+};
+
 static const struct file_operations proc_entry_fops = {
-    .read = modlist_read,
+    .open = modlist_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = seq_release,
     .write = modlist_write,    
 };
 
@@ -65,33 +80,29 @@ void exit_modlist_module( void )
 }
 
 
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-  char* modlistbuffer = (char *)vmalloc( BUFFER_LENGTH );
-  struct list_item* item=NULL;
-  struct list_head* cur_node=NULL;
-  ssize_t buf_length = 0;
-  
-  if ((*off) > 0) /* Tell the application that there is nothing left to read */
-    return 0;
-    
-  if (len<1)
-    return -ENOSPC;
+/* Lectura de la lista con seq_file: se genera un elemento por cada show(),
+*  asi que la lista sale completa sea cual sea su tamaño */
+static int modlist_open(struct inode *inode, struct file *file) {
+  return seq_open(file, &modlist_seq_ops);
+}
 
-  /* copiar los datos al buffer de modlist */
-  list_for_each(cur_node, &mylist) {
-    /* item points to the structure wherein the links are embedded */
-    item = list_entry(cur_node, struct list_item, links);
-    buf_length += sprintf(modlistbuffer + buf_length, "%s\n", item->string);
-  }
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos) {
+  return seq_list_start(&mylist, *pos);
+}
 
-  /* Transfer data from the kernel to userspace  */
-  if (copy_to_user(buf, modlistbuffer, buf_length))
-    return -EINVAL;
-    
-  (*off)+=len;  /* Update the file pointer */
-  vfree(modlistbuffer);
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+  return seq_list_next(v, &mylist, pos);
+}
+
+static void modlist_seq_stop(struct seq_file *m, void *v) {
+}
+
+static int modlist_seq_show(struct seq_file *m, void *v) {
+  /* item points to the structure wherein the links are embedded */
+  struct list_item* item = list_entry(v, struct list_item, links);
 
-  return buf_length;
+  seq_printf(m, "%s\n", item->string);
+  return 0;
 }
 
 static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
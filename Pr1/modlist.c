@@ -1,8 +1,10 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <asm-generic/uaccess.h>
 #include <linux/list.h>
 
@@ -11,6 +13,7 @@ MODULE_LICENSE("GPL");
 #define BUFFER_LENGTH 1024
 
 static struct proc_dir_entry *proc_entry;
+static struct proc_dir_entry *proc_stats_entry;
 
 /* Nodos de la lista */
 typedef struct list_item {
@@ -19,18 +22,39 @@ typedef struct list_item {
 } list_item_t;
 
 struct list_head mylist; /* Lista enlazada. OJO todos los demás nodos están en memoria dinámica. */
-
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
+static struct kmem_cache *item_cache; /* Cache slab para los nodos de la lista */
+static atomic_t items_in_use = ATOMIC_INIT(0);
+
+static int modlist_open(struct inode *inode, struct file *file);
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos);
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos);
+static void modlist_seq_stop(struct seq_file *m, void *v);
+static int modlist_seq_show(struct seq_file *m, void *v);
 static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off);
-static void modlist_add(int num);
+static int modlist_add(int num);
 static void modlist_remove(int num);
 static void modlist_cleanup(void);
+static ssize_t modlist_stats_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
+
+static const struct seq_operations modlist_seq_ops = {
+    .start = modlist_seq_start,
+    .next = modlist_seq_next,
+    .stop = modlist_seq_stop,
+    .show = modlist_seq_show,
+};
 
 static const struct file_operations proc_entry_fops = {
-    .read = modlist_read,
+    .open = modlist_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = seq_release,
     .write = modlist_write,    
 };
 
+static const struct file_operations proc_stats_fops = {
+    .read = modlist_stats_read,
+};
+
 int init_modlist_module( void )
 {
   int ret = 0;
@@ -41,10 +65,22 @@ int init_modlist_module( void )
     ret = -ENOMEM;
   } else {
 
+    item_cache = kmem_cache_create("modlist_item", sizeof(struct list_item), 0, 0, NULL);
+    if (item_cache == NULL) {
+      printk(KERN_INFO "modlist: Can't create slab cache\n");
+      return -ENOMEM;
+    }
+
     proc_entry = proc_create( "modlist", 0666, NULL, &proc_entry_fops);
-    if (proc_entry == NULL) {
+    proc_stats_entry = proc_create( "modlist_stats", 0444, NULL, &proc_stats_fops);
+    if (proc_entry == NULL || proc_stats_entry == NULL) {
       ret = -ENOMEM;
       printk(KERN_INFO "modlist: Can't create /proc entry\n");
+      if (proc_entry)
+        remove_proc_entry("modlist", NULL);
+      if (proc_stats_entry)
+        remove_proc_entry("modlist_stats", NULL);
+      kmem_cache_destroy(item_cache);
     } else {
       printk(KERN_INFO "modlist: Module loaded\n");
     }
@@ -57,40 +93,38 @@ int init_modlist_module( void )
 void exit_modlist_module( void )
 {
   remove_proc_entry("modlist", NULL);
+  remove_proc_entry("modlist_stats", NULL);
   //vfree(&mylist); LA CABEZA NO ESTÁ EN MEMORIA DINÁMICA, CON HACER UN CLEANUP VALE
   modlist_cleanup(); // <- porque los demás nodos sí están en memoria dinámica pero mylist en la pila
+  kmem_cache_destroy(item_cache);
   
   printk(KERN_INFO "modlist: Module unloaded.\n");
 }
 
 
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-  char* modlistbuffer = (char *)vmalloc( BUFFER_LENGTH );
-  struct list_item* item=NULL;
-  struct list_head* cur_node=NULL;
-  ssize_t buf_length = 0;
-  
-  if ((*off) > 0) /* Tell the application that there is nothing left to read */
-    return 0;
-    
-  if (len<1)
-    return -ENOSPC;
+/* Lectura de la lista con seq_file: se genera un elemento por cada show(),
+*  asi que la lista sale completa sea cual sea su tamaño */
+static int modlist_open(struct inode *inode, struct file *file) {
+  return seq_open(file, &modlist_seq_ops);
+}
 
-  /* copiar los datos al buffer de modlist */
-  list_for_each(cur_node, &mylist) {
-    /* item points to the structure wherein the links are embedded */
-    item = list_entry(cur_node, struct list_item, links);
-    buf_length += sprintf(modlistbuffer + buf_length, "%i\n", item->data);
-  }
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos) {
+  return seq_list_start(&mylist, *pos);
+}
 
-  /* Transfer data from the kernel to userspace  */
-  if (copy_to_user(buf, modlistbuffer, buf_length))
-    return -EINVAL;
-    
-  (*off)+=len;  /* Update the file pointer */
-  vfree(modlistbuffer);
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+  return seq_list_next(v, &mylist, pos);
+}
 
-  return buf_length;
+static void modlist_seq_stop(struct seq_file *m, void *v) {
+}
+
+static int modlist_seq_show(struct seq_file *m, void *v) {
+  /* item points to the structure wherein the links are embedded */
+  struct list_item* item = list_entry(v, struct list_item, links);
+
+  seq_printf(m, "%i\n", item->data);
+  return 0;
 }
 
 static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
@@ -114,7 +148,10 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
   
 
   if(sscanf(modlistbuffer, "add %i", &num) == 1) {
-    modlist_add(num);
+    if (modlist_add(num)) {
+      vfree(modlistbuffer);
+      return -ENOMEM;
+    }
 	}
   else if(sscanf(modlistbuffer, "remove %i", &num) == 1) {
     modlist_remove(num);
@@ -130,12 +167,17 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
   return len;
 }
 
-static void modlist_add(int num) {
-  struct list_item* nodo = vmalloc(sizeof(struct list_item));
-    
+static int modlist_add(int num) {
+  struct list_item* nodo = kmem_cache_alloc(item_cache, GFP_KERNEL);
+
+  if (nodo == NULL)
+    return -ENOMEM;
+
+  atomic_inc(&items_in_use);
   nodo->data = num;
 
   list_add_tail(&nodo->links,&mylist);
+  return 0;
 }
 
 static void modlist_remove(int num) {
@@ -148,7 +190,8 @@ static void modlist_remove(int num) {
 
   	if(item->data == num) {
   		list_del(cur_node);
-      vfree(item);
+      kmem_cache_free(item_cache, item);
+      atomic_dec(&items_in_use);
     }
 	}
 }
@@ -162,10 +205,32 @@ static void modlist_cleanup(void) {
     item = list_entry(cur_node, struct list_item, links);
 
     list_del(cur_node);
-    vfree(item);
+    kmem_cache_free(item_cache, item);
+    atomic_dec(&items_in_use);
   }
 }
 
+static ssize_t modlist_stats_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+  char statsbuffer[64];
+  ssize_t buf_length = 0;
+
+  if ((*off) > 0) /* Tell the application that there is nothing left to read */
+    return 0;
+
+  buf_length += sprintf(statsbuffer, "items_in_use=%d\n", atomic_read(&items_in_use));
+
+  if (len < buf_length)
+    return -ENOSPC;
+
+  /* Transfer data from the kernel to userspace  */
+  if (copy_to_user(buf, statsbuffer, buf_length))
+    return -EFAULT;
+
+  (*off)+=buf_length;  /* Update the file pointer */
+
+  return buf_length;
+}
+
 
 module_init( init_modlist_module );
 module_exit( exit_modlist_module );
@@ -0,0 +1,197 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <err.h>
+#include "cbuffer.h"
+
+#define DEFAULT_NR_ITEMS 10000000
+#define DEFAULT_CAPACITY 1024
+#define DEFAULT_BATCH 32
+#define MAX_ITEM_SIZE 256
+
+/* Element sizes measured */
+static const unsigned int item_sizes[]={1,4,8,16,64,MAX_ITEM_SIZE};
+
+char* nombre_programa=NULL;
+
+static long nr_items=DEFAULT_NR_ITEMS;
+static unsigned int capacity=DEFAULT_CAPACITY;
+static int batch=DEFAULT_BATCH;
+
+static double now (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char* test, unsigned int item_size, double secs) {
+  printf("%-8s %4u B %9.3f s %8.2f Mitems/s %9.2f MB/s\n",
+	 test, item_size, secs, nr_items / secs / 1e6, nr_items * (double)item_size / secs / (1024*1024));
+}
+
+/* insert_cbuffer_t()/remove_cbuffer_t(), one element at a time */
+static void bench_single (unsigned int item_size) {
+  cbuffer_t* cbuf=create_cbuffer_t(capacity,item_size);
+  char item[MAX_ITEM_SIZE]={0};
+  long i, j, chunk;
+  double start;
+
+  if (!cbuf)
+	errx(1,"create_cbuffer_t");
+
+  start=now();
+  for (i=0;i<nr_items;i+=chunk) {
+	/* Fill half of the buffer and drain it */
+	chunk=cbuf->max_size/2;
+	if (chunk>nr_items-i)
+		chunk=nr_items-i;
+	for (j=0;j<chunk;j++)
+		insert_cbuffer_t(cbuf,item);
+	for (j=0;j<chunk;j++)
+		remove_cbuffer_t(cbuf,item);
+  }
+  report("single",item_size,now()-start);
+
+  destroy_cbuffer_t(cbuf);
+}
+
+/* insert_items_cbuffer_t()/remove_items_cbuffer_t() in batches */
+static void bench_batch (unsigned int item_size) {
+  cbuffer_t* cbuf=create_cbuffer_t(capacity,item_size);
+  char* items=calloc(batch,item_size);
+  long i;
+  int n;
+  double start;
+
+  if (!cbuf || !items)
+	errx(1,"create_cbuffer_t");
+
+  start=now();
+  for (i=0;i<nr_items;i+=n) {
+	n=(nr_items-i<batch)?nr_items-i:batch;
+	insert_items_cbuffer_t(cbuf,items,n);
+	remove_items_cbuffer_t(cbuf,items,n);
+  }
+  report("batch",item_size,now()-start);
+
+  destroy_cbuffer_t(cbuf);
+  free(items);
+}
+
+static cbuffer_t* spsc_cbuf;
+
+static void* spsc_producer (void* arg) {
+  char* items=calloc(batch,spsc_cbuf->item_size);
+  long i;
+  int n;
+
+  if (!items)
+	errx(1,"calloc");
+
+  for (i=0;i<nr_items;i+=n) {
+	n=(nr_items-i<batch)?nr_items-i:batch;
+	n=spsc_insert_items_cbuffer_t(spsc_cbuf,items,n);
+	if (n==0)
+		sched_yield(); /* Let the consumer run if we share the CPU */
+  }
+
+  free(items);
+  return NULL;
+}
+
+/* spsc_insert_items_cbuffer_t()/spsc_remove_items_cbuffer_t() from two threads, without locks */
+static void bench_spsc (unsigned int item_size) {
+  char* items=calloc(batch,item_size);
+  pthread_t producer;
+  long i;
+  int n;
+  double start;
+
+  spsc_cbuf=create_cbuffer_t(capacity,item_size);
+  if (!spsc_cbuf || !items)
+	errx(1,"create_cbuffer_t");
+
+  start=now();
+  if (pthread_create(&producer,NULL,spsc_producer,NULL))
+	errx(1,"pthread_create");
+  for (i=0;i<nr_items;i+=n) {
+	n=spsc_remove_items_cbuffer_t(spsc_cbuf,items,batch);
+	if (n==0)
+		sched_yield();
+  }
+  pthread_join(producer,NULL);
+  report("spsc",item_size,now()-start);
+
+  destroy_cbuffer_t(spsc_cbuf);
+  free(items);
+}
+
+static void
+uso (int status)
+{
+  if (status != EXIT_SUCCESS)
+    warnx("Pruebe `%s -h' para obtener mas informacion.\n", nombre_programa);
+  else
+    {
+      printf ("Uso: %s [OPCIONES]\n", nombre_programa);
+fputs ("\
+  -n <num>,   numero de elementos a insertar y extraer (por defecto 10000000)\n\
+  -c <num>,   capacidad del buffer circular (por defecto 1024)\n\
+  -b <num>,   elementos por operacion en las pruebas por lotes (por defecto 32)\n\
+", stdout);
+      fputs ("\
+  -h,	Muestra este breve recordatorio de uso\n\
+", stdout);
+    }
+    exit (status);
+}
+
+int
+main (int argc, char **argv)
+{
+  int optc;
+  int i;
+  nombre_programa = argv[0];
+
+  while ((optc = getopt (argc, argv, "hn:c:b:")) != -1)
+    {
+      switch (optc)
+	{
+
+	case 'h':
+	  uso(EXIT_SUCCESS);
+	  break;
+	
+	case 'n':
+	  nr_items=atol(optarg);
+	  break;
+
+	case 'c':
+	  capacity=atoi(optarg);
+	  break;
+
+	case 'b':
+	  batch=atoi(optarg);
+	  break;
+
+	default:
+	  uso (EXIT_FAILURE);
+	}
+    }
+
+  if (nr_items<=0 || capacity<2 || batch<=0 || batch>capacity)
+	uso(EXIT_FAILURE);
+
+  for (i=0;i<sizeof(item_sizes)/sizeof(item_sizes[0]);i++) {
+	bench_single(item_sizes[i]);
+	bench_batch(item_sizes[i]);
+	bench_spsc(item_sizes[i]);
+  }
+
+  exit (EXIT_SUCCESS);
+}
@@ -10,6 +10,10 @@
 #include <time.h>
 #include <err.h>
 #include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <poll.h>
 #define MAX_MESSAGE_SIZE 32
 
 char* nombre_programa=NULL;
@@ -92,6 +96,234 @@ static void fifo_receive (const char* path_fifo) {
    close(fd_fifo);
 }
 
+static uint64_t now_ns (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Cabecera de cada mensaje de la prueba de rendimiento; el resto hasta
+   msg_size bytes es relleno */
+struct bench_message {
+	uint64_t seq;		/* número de mensaje dentro de su productor */
+	uint64_t timestamp;	/* instante de envío (CLOCK_MONOTONIC, ns) */
+};
+
+/* Estado compartido por los procesos de la prueba (en memoria compartida) */
+struct bench {
+	const char* path_fifo;
+	size_t msg_size;
+	long nr_messages;	/* mensajes por productor */
+	uint64_t* latencies;	/* latencia extremo a extremo de cada mensaje (ns) */
+	uint64_t nr_latencies;	/* entradas ocupadas de latencies (atómico) */
+	uint64_t received;	/* mensajes recibidos (atómico) */
+	uint64_t sum;		/* suma de los números de mensaje recibidos (atómico) */
+};
+
+/* Productor: cada proceso abre su propio descriptor y envía nr_messages
+   mensajes numerados con el instante de envío */
+static void bench_producer (struct bench* b) {
+  struct bench_message* message;
+  int fd_fifo;
+  uint64_t seq;
+
+  if ((fd_fifo=open(b->path_fifo,O_WRONLY))<0)
+	err(1,"%s",b->path_fifo);
+
+  if ((message=calloc(1,b->msg_size))==NULL)
+	err(1,"calloc");
+
+  for (seq=0;seq<b->nr_messages;seq++) {
+	message->seq=seq;
+	message->timestamp=now_ns();
+	if (write(fd_fifo,message,b->msg_size)!=b->msg_size)
+		err(1,"Error when writing to the FIFO");
+  }
+
+  free(message);
+  close(fd_fifo);
+}
+
+/* Lee un mensaje completo. Un FIFO de bytes puede devolver menos (p.ej. un
+   pipe de mkfifo): se completa con más lecturas, lo que sólo conserva los
+   límites de los mensajes si hay un único consumidor. Devuelve 0 en fin
+   de fichero */
+static int read_message (int fd_fifo, char* buf, size_t size) {
+  size_t done=0;
+  ssize_t bytes;
+
+  while (done<size) {
+	bytes=read(fd_fifo,buf+done,size-done);
+	if (bytes<0)
+		err(1,"Error when reading from the FIFO");
+	if (bytes==0)
+		break;
+	done+=bytes;
+  }
+
+  if (done>0 && done!=size)
+	errx(1,"Can't read the whole register");
+  return done>0;
+}
+
+/* Consumidor: lee hasta fin de fichero y anota la latencia de cada mensaje */
+static void bench_consumer (struct bench* b) {
+  struct bench_message* message;
+  uint64_t received=0, sum=0, pos;
+  int fd_fifo;
+
+  if ((fd_fifo=open(b->path_fifo,O_RDONLY))<0)
+	err(1,"%s",b->path_fifo);
+
+  if ((message=malloc(b->msg_size))==NULL)
+	err(1,"malloc");
+
+  while (read_message(fd_fifo,(char*)message,b->msg_size)) {
+	pos=__atomic_fetch_add(&b->nr_latencies,1,__ATOMIC_RELAXED);
+	b->latencies[pos]=now_ns()-message->timestamp;
+	received++;
+	sum+=message->seq;
+  }
+
+  __atomic_fetch_add(&b->received,received,__ATOMIC_RELAXED);
+  __atomic_fetch_add(&b->sum,sum,__ATOMIC_RELAXED);
+  free(message);
+  close(fd_fifo);
+}
+
+static int cmp_u64 (const void* a, const void* b) {
+  uint64_t x=*(const uint64_t*)a, y=*(const uint64_t*)b;
+
+  return (x>y)-(x<y);
+}
+
+/* Percentil p (0-100) de un vector ordenado, en microsegundos */
+static double percentile_us (const uint64_t* sorted, uint64_t n, double p) {
+  uint64_t idx=(uint64_t)(p/100.0*(n-1)+0.5);
+
+  return sorted[idx]/1000.0;
+}
+
+/* Prueba de rendimiento con nr_prod productores y nr_cons consumidores
+   (procesos, cada uno con su propio open() del FIFO) usando el FIFO a la
+   vez: caudal y latencia extremo a extremo */
+static void fifo_bench (const char* path_fifo, int nr_prod, int nr_cons, long nr_messages, size_t msg_size) {
+  struct bench* b;
+  uint64_t expected=(uint64_t)nr_prod*nr_messages;
+  uint64_t expected_sum=(uint64_t)nr_prod*nr_messages*(nr_messages-1)/2;
+  uint64_t start, elapsed;
+  double secs;
+  int i, status, failed=0;
+
+  /* Los hijos anotan sus resultados en memoria compartida con el padre */
+  b=mmap(NULL,sizeof(*b),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  if (b==MAP_FAILED)
+	err(1,"mmap");
+  memset(b,0,sizeof(*b));
+  b->path_fifo=path_fifo;
+  b->msg_size=msg_size;
+  b->nr_messages=nr_messages;
+  b->latencies=mmap(NULL,expected*sizeof(uint64_t),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  if (b->latencies==MAP_FAILED)
+	err(1,"mmap");
+
+  start=now_ns();
+  for (i=0;i<nr_cons+nr_prod;i++) {
+	switch (fork()) {
+	case -1:
+		err(1,"fork");
+	case 0:
+		if (i<nr_cons)
+			bench_consumer(b);
+		else
+			bench_producer(b);
+		exit(EXIT_SUCCESS);
+	}
+  }
+  for (i=0;i<nr_cons+nr_prod;i++) {
+	if (wait(&status)<0 || !WIFEXITED(status) || WEXITSTATUS(status)!=EXIT_SUCCESS)
+		failed++;
+  }
+  elapsed=now_ns()-start;
+  secs=elapsed/1e9;
+
+  if (failed || b->received!=expected || b->sum!=expected_sum)
+	errx(1,"Se esperaban %llu mensajes y se recibieron %llu (%d procesos fallaron)",
+	     (unsigned long long)expected,(unsigned long long)b->received,failed);
+
+  qsort(b->latencies,b->nr_latencies,sizeof(uint64_t),cmp_u64);
+
+  printf("%s: %d productores, %d consumidores, mensajes de %zu bytes\n",
+	 path_fifo, nr_prod, nr_cons, msg_size);
+  printf("  %llu mensajes en %.3f s: %.0f mensajes/s, %.2f MB/s\n",
+	 (unsigned long long)b->received, secs,
+	 b->received/secs, b->received*msg_size/secs/(1024*1024));
+  printf("  latencia (us): p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+	 percentile_us(b->latencies,b->nr_latencies,50),
+	 percentile_us(b->latencies,b->nr_latencies,99),
+	 percentile_us(b->latencies,b->nr_latencies,99.9),
+	 b->latencies[b->nr_latencies-1]/1000.0);
+
+  munmap(b->latencies,expected*sizeof(uint64_t));
+  munmap(b,sizeof(*b));
+}
+
+/* Prueba de poll() con O_NONBLOCK: un write() después de POLLOUT debe avanzar,
+   y tras un EAGAIN poll() no debe volver a indicar POLLOUT sin que se haya
+   leído nada (si no, un bucle de eventos giraría sin fin). En cada ronda se
+   escribe mientras poll() lo permita y luego se lee un mensaje */
+static void fifo_poll_test (const char* path_fifo, long nr_rounds, size_t msg_size) {
+  struct pollfd pfd;
+  char* message;
+  int fd_read, fd_write;
+  long round, nr_writes=0;
+  ssize_t bytes;
+
+  /* El lector se abre primero para que el escritor sin bloqueo no falle con ENXIO */
+  if ((fd_read=open(path_fifo,O_RDONLY|O_NONBLOCK))<0)
+	err(1,"%s",path_fifo);
+  if ((fd_write=open(path_fifo,O_WRONLY|O_NONBLOCK))<0)
+	err(1,"%s",path_fifo);
+
+  if ((message=calloc(1,msg_size))==NULL)
+	err(1,"calloc");
+
+  pfd.fd=fd_write;
+  pfd.events=POLLOUT;
+
+  for (round=0;round<nr_rounds;round++) {
+	while (poll(&pfd,1,0)>0 && (pfd.revents & POLLOUT)) {
+		bytes=write(fd_write,message,msg_size);
+		if (bytes<0 && errno==EAGAIN)
+			errx(1,"write() devuelve EAGAIN tras POLLOUT (ronda %ld)",round);
+		if (bytes<=0)
+			err(1,"Error when writing to the FIFO");
+		nr_writes++;
+	}
+	if (pfd.revents & (POLLERR|POLLHUP|POLLNVAL))
+		errx(1,"poll() indica error en el FIFO (revents=%#x)",pfd.revents);
+
+	/* poll() puede ser conservador: se escribe hasta el EAGAIN, y a partir
+	   de ahí no debe indicar POLLOUT hasta que se lea */
+	while ((bytes=write(fd_write,message,msg_size))>0)
+		;
+	if (bytes==0 || errno!=EAGAIN)
+		err(1,"Error when writing to the FIFO");
+	if (poll(&pfd,1,0)>0 && (pfd.revents & POLLOUT))
+		errx(1,"poll() indica POLLOUT tras un EAGAIN (ronda %ld)",round);
+
+	if (read(fd_read,message,msg_size)<=0)
+		err(1,"Error when reading from the FIFO");
+  }
+
+  printf("%s: %ld rondas, %ld escrituras tras POLLOUT sin EAGAIN\n",path_fifo,nr_rounds,nr_writes);
+
+  free(message);
+  close(fd_write);
+  close(fd_read);
+}
+
 static void
 uso (int status)
 {
@@ -103,6 +335,15 @@ uso (int status)
 fputs ("\
   -r,  el proceso actúa como receptor de los mensajes el FIFO\n\
   -s,  el proceso envía los mensajes leidos de la entrada estandar por el FIFO\n\
+  -P <num>,  prueba de rendimiento con <num> procesos productores\n\
+  -C <num>,  prueba de rendimiento con <num> procesos consumidores\n\
+  -n <num>,  mensajes que envía cada productor en la prueba (por defecto 100000)\n\
+  -m <num>,  tamaño en bytes de cada mensaje de la prueba (por defecto 36, minimo 16)\n\
+  -N,  prueba de poll() con O_NONBLOCK: -n rondas de llenar el FIFO y leer un mensaje\n\
+\n\
+  La prueba informa de MB/s, mensajes/s y de los percentiles 50, 99 y 99.9 de\n\
+  la latencia extremo a extremo. Sirve para comparar /proc/modfifo (semaforos\n\
+  o kfifo) con un FIFO creado con mkfifo en la misma maquina.\n\
 ", stdout);
       fputs ("\
   -h,	Muestra este breve recordatorio de uso\n\
@@ -117,9 +358,13 @@ main (int argc, char **argv)
   int optc;
   char* path_fifo=NULL;
   int receive=0;
+  int poll_test=0;
+  int nr_prod=0, nr_cons=0;
+  long nr_messages=100000;
+  long msg_size=sizeof(struct fifo_message);
   nombre_programa = argv[0];
 
-  while ((optc = getopt (argc, argv, "srhf:")) != -1)
+  while ((optc = getopt (argc, argv, "srhNf:P:C:n:m:")) != -1)
     {
       switch (optc)
 	{
@@ -136,10 +381,30 @@ main (int argc, char **argv)
 	  receive=0;
 	  break;	
 
+	case 'N':
+	  poll_test=1;
+	  break;
+
 	case 'f':
 	  path_fifo=optarg;
 	  break;	
 
+	case 'P':
+	  nr_prod=atoi(optarg);
+	  break;
+
+	case 'C':
+	  nr_cons=atoi(optarg);
+	  break;
+
+	case 'n':
+	  nr_messages=atol(optarg);
+	  break;
+
+	case 'm':
+	  msg_size=atol(optarg);
+	  break;
+
 	default:
 	  uso (EXIT_FAILURE);
 	}
@@ -147,8 +412,18 @@ main (int argc, char **argv)
 
  if (!path_fifo)
 	uso(EXIT_FAILURE);
- 
-  if (receive)
+
+  if (poll_test) {
+	if (nr_messages<=0 || msg_size<=0)
+		uso(EXIT_FAILURE);
+	fifo_poll_test(path_fifo,nr_messages,msg_size);
+  }
+  else if (nr_prod>0 || nr_cons>0) {
+	if (nr_prod<=0 || nr_cons<=0 || nr_messages<=0 || msg_size<(long)sizeof(struct bench_message))
+		uso(EXIT_FAILURE);
+	fifo_bench(path_fifo,nr_prod,nr_cons,nr_messages,msg_size);
+  }
+  else if (receive)
 	fifo_receive(path_fifo);
   else
 	fifo_send(path_fifo);
@@ -0,0 +1 @@
+../cbuffer.c
\ No newline at end of file
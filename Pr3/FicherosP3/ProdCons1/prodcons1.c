@@ -65,7 +65,7 @@ static ssize_t prodcons_write(struct file *filp, const char __user *buf, size_t
   }
 
   /* Inserción segura en el buffer circular */
-  insert_cbuffer_t(cbuf,item);
+  insert_cbuffer_t(cbuf,&item);
 
   /* Salir de la SC */
   up(&mtx);
@@ -101,8 +101,7 @@ static ssize_t prodcons_read(struct file *filp, char __user *buf, size_t len, lo
   }
 
   /* Obtener el primer elemento del buffer y eliminarlo */
-  item=head_cbuffer_t(cbuf);
-  remove_cbuffer_t(cbuf);  
+  remove_cbuffer_t(cbuf,&item);  
 
   /* Salir de la SC */ 
   up(&mtx);
@@ -137,7 +136,7 @@ int init_prodcons_module( void )
 {
 
   /* Inicialización del buffer */  
-  cbuf = create_cbuffer_t(MAX_ITEMS_CBUF);
+  cbuf = create_cbuffer_t(MAX_ITEMS_CBUF,sizeof(int*));
 
   if (!cbuf) {
     return -ENOMEM;
@@ -0,0 +1 @@
+../cbuffer.h
\ No newline at end of file
@@ -11,7 +11,10 @@
 
 
 #define MAX_ITEMS_CBUF	5
-#define MAX_CHARS_KBUF	10
+#define MAX_ITEMS_WRITE	32	/* Enteros por escritura */
+#define MAX_ITEMS_READ	32	/* Enteros por lectura */
+#define MAX_CHARS_ITEM	12	/* "-2147483648\n" */
+#define MAX_CHARS_KBUF	(MAX_ITEMS_WRITE*MAX_CHARS_ITEM)	/* Caben MAX_ITEMS_WRITE enteros de cualquier valor */
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Productor/Consumidor v2 para DSO");
@@ -23,14 +26,27 @@ struct semaphore prod_queue,cons_queue;
 struct semaphore mtx;
 int nr_prod_waiting,nr_cons_waiting;
 
+/* Despierta a todos los procesos bloqueados en una cola. Se invoca con mtx adquirido */
+static void wake_up_all_waiting(struct semaphore* queue, int* nr_waiting)
+{
+  while ((*nr_waiting)>0)
+  {
+	up(queue);
+	(*nr_waiting)--;
+  }
+}
+
+/* Cada escritura admite un lote de enteros separados por espacios ("1 2 3").
+   Como en una escritura parcial, devuelve los bytes de los enteros insertados
+   (si no caben todos en un lote o llega una señal), y el resto puede volver a
+   escribirse */
 static ssize_t prodcons_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
   char kbuf[MAX_CHARS_KBUF+1];
-  int val=0;
-  int* item=NULL;
+  int items[MAX_ITEMS_WRITE];
+  int ends[MAX_ITEMS_WRITE];	/* Bytes de kbuf hasta el final de cada entero */
+  char* pos=kbuf;
+  int nr_items=0,done=0,n,chars;
 
-  if ((*off) > 0) /* The application can write in this entry just once !! */
-    return 0;
-  
   if (len > MAX_CHARS_KBUF) {
     return -ENOSPC;
   }
@@ -39,16 +55,25 @@ static ssize_t prodcons_write(struct file *filp, const char __user *buf, size_t
   }
 
   kbuf[len] ='\0'; 
-   *off+=len;            /* Update the file pointer */
    
-  if (sscanf(kbuf,"%i",&val)!=1)
+  /* Los enteros se guardan directamente en el buffer, sin reservar memoria para cada uno */
+  while (nr_items<MAX_ITEMS_WRITE && sscanf(pos,"%i%n",&items[nr_items],&chars)==1)
+  {
+	pos+=chars;
+	ends[nr_items++]=pos-kbuf;
+  }
+
+  if (nr_items==0)
   {
 	return -EINVAL;
   }
-	
-  item=vmalloc(sizeof(int));
 
-  (*item)=val;
+  /* Tras el último entero sólo puede haber espacios, que también se consumen.
+     Con el lote lleno, lo que siga se deja para la siguiente escritura */
+  if (*skip_spaces(pos)=='\0')
+	ends[nr_items-1]=len;
+  else if (nr_items<MAX_ITEMS_WRITE)
+	return -EINVAL;
 
   /* Acceso a la sección crítica */
   if (down_interruptible(&mtx))
@@ -56,51 +81,62 @@ static ssize_t prodcons_write(struct file *filp, const char __user *buf, size_t
 	return -EINTR;
   }
 
-  /* Bloquearse mientras no haya huecos en el buffer */
-  while (is_full_cbuffer_t(cbuf))
+  while (done<nr_items)
   {
-	/* Incremento de productores esperando */
-	nr_prod_waiting++;
-
-	/* Liberar el 'mutex' antes de bloqueo*/
-	up(&mtx);
-
-	/* Bloqueo en cola de espera */		
-	if (down_interruptible(&prod_queue)){
-		down(&mtx);
-		nr_prod_waiting--;
-		up(&mtx);		
-		return -EINTR;
-	}	
-
-	/* Readquisición del 'mutex' antes de entrar a la SC */				
-	if (down_interruptible(&mtx)){
-		return -EINTR;
-	}	
-  }
-
-  /* Insertar en el buffer */
-  insert_cbuffer_t(cbuf,item); 
-  
-  /* Despertar a los productores bloqueados (si hay alguno) */
-  if (nr_cons_waiting>0)
-  {
-	up(&cons_queue);	
-	nr_cons_waiting--;
+	/* Bloquearse mientras no haya huecos en el buffer */
+	while (is_full_cbuffer_t(cbuf))
+	{
+		/* Incremento de productores esperando */
+		nr_prod_waiting++;
+
+		/* Liberar el 'mutex' antes de bloqueo*/
+		up(&mtx);
+
+		/* Bloqueo en cola de espera. Si llega una señal tras insertar parte del
+		   lote, se devuelven los bytes de los enteros ya insertados */
+		if (down_interruptible(&prod_queue)){
+			down(&mtx);
+			nr_prod_waiting--;
+			up(&mtx);
+			goto out_partial;
+		}
+
+		/* Readquisición del 'mutex' antes de entrar a la SC */
+		if (down_interruptible(&mtx)){
+			goto out_partial;
+		}
+	}
+
+	/* Insertar de una vez todos los que quepan: sólo se espera por el resto */
+	n=min(nr_gaps_cbuffer_t(cbuf),nr_items-done);
+	insert_items_cbuffer_t(cbuf,&items[done],n);
+	done+=n;
+
+	/* Despertar a los consumidores bloqueados (si hay alguno) */
+	wake_up_all_waiting(&cons_queue,&nr_cons_waiting);
   }
 
   /* Salir de la sección crítica */
   up(&mtx);
-  
-  return len;
+
+out_partial:
+  if (done==0)
+	return -EINTR;
+
+  *off+=ends[done-1];            /* Update the file pointer */
+  return ends[done-1];
 }
 
 
+/* Cada lectura extrae de una vez todos los elementos disponibles (hasta
+   MAX_ITEMS_READ) que quepan en el buffer de usuario, uno por línea */
 static ssize_t prodcons_read(struct file *filp, char __user *buf, size_t len, loff_t *off) 
 {
-  int nr_bytes=0;
-  int* item=NULL;
-  char kbuff[32]="";
+  int nr_bytes=0,chars;
+  int nr_items=0;
+  int i,j,n;
+  cbuffer_region_t region;
+  char kbuff[MAX_ITEMS_READ*MAX_CHARS_ITEM+1]="";
   
   if ((*off) > 0) 
       return 0;
@@ -134,28 +170,37 @@ static ssize_t prodcons_read(struct file *filp, char __user *buf, size_t len, lo
 	}	
   }
 
-  /* Obtener el primer elemento del buffer y eliminarlo */
-  item=head_cbuffer_t(cbuf);
-  remove_cbuffer_t(cbuf);  
-  
-  /* Despertar a los consumidores bloqueados (si hay alguno) */
-  if (nr_prod_waiting>0)
+  /* Formatear los primeros elementos del buffer mientras quepan en len */
+  n=peek_cbuffer_t(cbuf,&region,MAX_ITEMS_READ);
+  for (i=0;i<2 && nr_items<n;i++)
   {
-	up(&prod_queue);	
-	nr_prod_waiting--;
+	for (j=0;j<region.len[i];j++)
+	{
+		chars=sprintf(kbuff+nr_bytes,"%i\n",((int*)region.ptr[i])[j]);
+		if (nr_bytes+chars>len)
+			break;
+		nr_bytes+=chars;
+		nr_items++;
+	}
+	if (j<region.len[i])
+		break;
   }
 
+  if (nr_items==0)
+  {
+	up(&mtx);
+	return -ENOSPC;
+  }
+
+  /* Eliminar del buffer los elementos extraidos */
+  consume_cbuffer_t(cbuf,nr_items);
+  
+  /* Despertar a los productores bloqueados (si hay alguno) */
+  wake_up_all_waiting(&prod_queue,&nr_prod_waiting);
+
   /* Salir de la sección crítica */	
   up(&mtx);
    
-  nr_bytes=sprintf(kbuff,"%i\n",*item); 
-  
-  /* Liberar memoria del elemento extraido */
-  vfree(item);
-   
-  if (len < nr_bytes)
-    return -ENOSPC;
-  
   if (copy_to_user(buf,kbuff,nr_bytes))
     return -EINVAL;
    
@@ -172,7 +217,7 @@ static const struct file_operations proc_entry_fops = {
 int init_prodcons_module( void )
 { 
   /* Inicialización del buffer */  
-  cbuf = create_cbuffer_t(MAX_ITEMS_CBUF);
+  cbuf = create_cbuffer_t(MAX_ITEMS_CBUF,sizeof(int));
 
   if (!cbuf) {
     return -ENOMEM;
@@ -1,44 +1,142 @@
 #include "cbuffer.h"
 #ifdef __KERNEL__
+#include <linux/kernel.h> /* UINT_MAX */
+#include <linux/log2.h> /* roundup_pow_of_two() */
 #include <linux/vmalloc.h> /* vmalloc()/vfree()*/
 #include <asm/string.h> /* memcpy() */
+#include <asm/barrier.h> /* smp_load_acquire()/smp_store_release() */
 #else
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #endif
 
 #ifndef NULL
 #define NULL 0
 #endif
 
+/* Ordered accesses to the index owned by the other side in the SPSC functions */
+#ifdef __KERNEL__
+#define load_acquire(p) smp_load_acquire(p)
+#define store_release(p,v) smp_store_release(p,v)
+#else
+#define load_acquire(p) __atomic_load_n(p,__ATOMIC_ACQUIRE)
+#define store_release(p,v) __atomic_store_n(p,v,__ATOMIC_RELEASE)
+#endif
+
+/*
+ * head and tail are never wrapped: tail-head is the number of elements
+ * even after they overflow, and since max_size is a power of two the slot
+ * of element i is (i & (max_size-1)), without any division.
+ */
+#define slot(cbuffer,i) (&(cbuffer)->data[((i)&((cbuffer)->max_size-1))*(cbuffer)->item_size])
+
+/* Copies nr_items into the buffer from element pos on */
+static void copy_in(cbuffer_t* cbuffer, unsigned int pos, const char* items, unsigned int nr_items)
+{
+	unsigned int first=pos&(cbuffer->max_size-1);
+	unsigned int items_copied;
+	
+	/* Check if we can't store all items at the end of the buffer */
+	if (first+nr_items > cbuffer->max_size)
+	{
+		items_copied=cbuffer->max_size-first;
+		memcpy(slot(cbuffer,pos),items,items_copied*cbuffer->item_size);
+		nr_items-=items_copied;
+		items+=items_copied*cbuffer->item_size; //Move the pointer forward
+		pos+=items_copied;
+	}
+	
+	/* If we still have to copy elements -> do it*/
+	if (nr_items)
+		memcpy(slot(cbuffer,pos),items,nr_items*cbuffer->item_size);
+}
+
+/* Copies nr_items out of the buffer from element pos on */
+static void copy_out(cbuffer_t* cbuffer, unsigned int pos, char* items, unsigned int nr_items)
+{
+	unsigned int first=pos&(cbuffer->max_size-1);
+	unsigned int items_copied;
+	
+	/* Check if the items wrap around the end of the buffer */
+	if (first+nr_items > cbuffer->max_size)
+	{
+		items_copied=cbuffer->max_size-first;
+		memcpy(items,slot(cbuffer,pos),items_copied*cbuffer->item_size);
+		nr_items-=items_copied;
+		items+=items_copied*cbuffer->item_size; //Move the pointer forward
+		pos+=items_copied;
+	}
+	
+	/* If we still have to copy elements -> do it*/
+	if (nr_items)
+		memcpy(items,slot(cbuffer,pos),nr_items*cbuffer->item_size);
+}
+
+/* Describes nr_items slots from element pos on */
+static void fill_region(cbuffer_t* cbuffer, cbuffer_region_t* region, unsigned int pos, unsigned int nr_items)
+{
+	unsigned int first=pos&(cbuffer->max_size-1);
+	
+	region->ptr[0]=slot(cbuffer,pos);
+	region->len[0]=nr_items;
+	region->ptr[1]=cbuffer->data;
+	region->len[1]=0;
+	
+	/* Check if the region wraps around the end of the buffer */
+	if (first+nr_items > cbuffer->max_size)
+	{
+		region->len[0]=cbuffer->max_size-first;
+		region->len[1]=nr_items-region->len[0];
+	}
+}
+
 /* Create cbuffer */
-cbuffer_t* create_cbuffer_t (unsigned int max_size)
+cbuffer_t* create_cbuffer_t (unsigned int max_size, unsigned int item_size)
 {
+	unsigned int capacity=1;
+	cbuffer_t *cbuffer;
+
+	/* Round the capacity up to a power of two, which must fit in an
+	   unsigned int, and so must the size in bytes of the data vector */
+	if (max_size==0 || max_size>(1U<<31) || item_size==0)
+		return NULL;
+#ifdef __KERNEL__ 
+	capacity=roundup_pow_of_two(max_size);
+#else
+	while (capacity<max_size)
+		capacity<<=1;
+#endif
+	if (capacity>UINT_MAX/item_size)
+		return NULL;
+
 #ifdef __KERNEL__ 
-	cbuffer_t *cbuffer= (cbuffer_t *)vmalloc(sizeof(cbuffer_t));
+	cbuffer= (cbuffer_t *)vmalloc(sizeof(cbuffer_t));
 #else
-	cbuffer_t *cbuffer= (cbuffer_t *)malloc(sizeof(cbuffer_t));
+	cbuffer= (cbuffer_t *)malloc(sizeof(cbuffer_t));
 #endif
 	if (cbuffer == NULL)
 	{
 	    return NULL;
 	}
-	cbuffer->size=0;
+
 	cbuffer->head=0;
-	cbuffer->max_size=max_size;
+	cbuffer->tail=0;
+	cbuffer->max_size=capacity;
+	cbuffer->item_size=item_size;
 
-	/* Stores bytes */
+	/* Stores max_size elements */
 #ifdef __KERNEL__ 
-	cbuffer->data=vmalloc(max_size);
+	cbuffer->data=vmalloc(capacity*item_size);
 #else
-	cbuffer->data=malloc(max_size);
+	cbuffer->data=malloc(capacity*item_size);
 #endif
 	if ( cbuffer->data == NULL)
 	{
 #ifdef __KERNEL__ 
-		vfree(cbuffer->data);
+		vfree(cbuffer);
 #else
-		free(cbuffer->data);
+		free(cbuffer);
 #endif
 		return NULL;
 	}
@@ -48,8 +146,8 @@ cbuffer_t* create_cbuffer_t (unsigned int max_size)
 /* Release memory from circular buffer  */
 void destroy_cbuffer_t ( cbuffer_t* cbuffer )
 {
-    cbuffer->size=0;
     cbuffer->head=0;
+    cbuffer->tail=0;
     cbuffer->max_size=0;
 #ifdef __KERNEL__ 
     vfree(cbuffer->data);
@@ -63,154 +161,185 @@ void destroy_cbuffer_t ( cbuffer_t* cbuffer )
 /* Returns the number of elements in the buffer */
 int size_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return cbuffer->size ;
+	return cbuffer->tail-cbuffer->head;
 }
 
 int nr_gaps_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return cbuffer->max_size-cbuffer->size;
+	return cbuffer->max_size-size_cbuffer_t(cbuffer);
 }
 
 /* Return a non-zero value when buffer is full */
 int is_full_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return ( cbuffer->size == cbuffer->max_size ) ;
+	return ( size_cbuffer_t(cbuffer) == cbuffer->max_size ) ;
 }
 
 /* Return a non-zero value when buffer is empty */
 int is_empty_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	return ( cbuffer->size == 0 ) ;
+	return ( cbuffer->head == cbuffer->tail ) ;
 }
 
 
 /* Inserts an item at the end of the buffer */
-void insert_cbuffer_t ( cbuffer_t* cbuffer, char new_item )
+void insert_cbuffer_t ( cbuffer_t* cbuffer, const void* new_item )
 {
-	unsigned int pos=0;
-	/* The buffer is full */
-	if ( cbuffer->size == cbuffer->max_size )
-	{
-		/* Overwriting head position */
-		cbuffer->data[cbuffer->head]=new_item;
-		/* Now head position must be the next one*/
-		if ( cbuffer->size !=0 )
-			cbuffer->head= ( cbuffer->head+1 ) % cbuffer->max_size;
-		/* Size remains constant*/
-	}
-	else
-	{
-		if ( cbuffer->max_size!=0 )
-			pos= ( cbuffer->head+cbuffer->size ) % cbuffer->max_size;
-		cbuffer->data[pos]=new_item;
-		cbuffer->size++;
-	}
+	/* The buffer is full: overwriting head position */
+	if ( is_full_cbuffer_t(cbuffer) )
+		cbuffer->head++;
+
+	memcpy(slot(cbuffer,cbuffer->tail),new_item,cbuffer->item_size);
+	cbuffer->tail++;
 }
 
 /* Inserts nr_items into the buffer */
-void insert_items_cbuffer_t ( cbuffer_t* cbuffer, const char* items, int nr_items)
+void insert_items_cbuffer_t ( cbuffer_t* cbuffer, const void* items, int nr_items)
 {
-	int nr_items_left=nr_items;
-	int items_copied;
-	int nr_gaps=cbuffer->max_size-cbuffer->size;
-	int whead=(cbuffer->head+cbuffer->size)%cbuffer->max_size;
+	int nr_gaps=nr_gaps_cbuffer_t(cbuffer);
 	
 	/* Restriction: nr_items can't be greater than the max buffer size) */
 	if (nr_items>cbuffer->max_size)
 		return;
 	
-	/* Check if we can't store all items at the end of the buffer */
-	if (whead+nr_items_left > cbuffer->max_size)
-	{
-		items_copied=cbuffer->max_size-whead;
-		memcpy(&cbuffer->data[whead],items,items_copied);
-		nr_items_left-=items_copied;
-		items+=items_copied; //Move the pointer forward
-		whead=0;		
-	}
-	
-	/* If we still have to copy elements -> do it*/
-	if (nr_items_left)
-	{
-		memcpy(&cbuffer->data[whead],items,nr_items_left);
-		whead+=nr_items_left;
-	}
+	copy_in(cbuffer,cbuffer->tail,items,nr_items);
+	cbuffer->tail+=nr_items;
 	
-	/* Update size and head */
-	if (nr_gaps>=nr_items)
-	{
-		cbuffer->size+=nr_items;
-	}else
-	{
-		cbuffer->size=cbuffer->max_size;
-		/* head moves in the event we overwrite stuff */
-		cbuffer->head=(cbuffer->head+(nr_items-nr_gaps))% cbuffer->max_size;
-	}
+	/* head moves in the event we overwrite stuff */
+	if (nr_gaps<nr_items)
+		cbuffer->head+=nr_items-nr_gaps;
 }
 
 /* Removes nr_items from the buffer and returns a copy of them */
-void remove_items_cbuffer_t ( cbuffer_t* cbuffer, char* items, int nr_items)
+void remove_items_cbuffer_t ( cbuffer_t* cbuffer, void* items, int nr_items)
 {
-	int nr_items_left=nr_items;
-	int items_copied;
-	
 	/* Restriction: nr_items can't be greater than the buffer size (Ignore)) */
-	if (nr_items>cbuffer->size)
+	if (nr_items>size_cbuffer_t(cbuffer))
 		return;	
 	
-	/* Check if we can't store all items at the end of the buffer */
-	if (cbuffer->head+nr_items_left > cbuffer->max_size)
-	{
-		items_copied=cbuffer->max_size-cbuffer->head;
-		memcpy(items,&cbuffer->data[cbuffer->head],items_copied);
-		nr_items_left-=items_copied;
-		items+=items_copied; //Move the pointer forward
-		cbuffer->head=0;		
-	}
-	
-	
-	/* If we still have to copy elements -> do it*/
-	if (nr_items_left)
-	{
-		memcpy(items,&cbuffer->data[cbuffer->head],nr_items_left);
-		cbuffer->head+=nr_items_left;
-	}
-	
-	/* Update size */
-	cbuffer->size-=nr_items;
+	copy_out(cbuffer,cbuffer->head,items,nr_items);
+	cbuffer->head+=nr_items;
 }
 
 
 /* Remove first element in the buffer */
-char remove_cbuffer_t ( cbuffer_t* cbuffer)
+int remove_cbuffer_t ( cbuffer_t* cbuffer, void* item)
 {
-	char ret='\0';
-	
-	if ( cbuffer->size !=0 )
-	{
-		ret=cbuffer->data[cbuffer->head];	
-		cbuffer->head= ( cbuffer->head+1 ) % cbuffer->max_size;
-		cbuffer->size--;
-	}
+	if ( is_empty_cbuffer_t(cbuffer) )
+		return 0;
 	
-	return ret;
+	if (item)
+		memcpy(item,slot(cbuffer,cbuffer->head),cbuffer->item_size);
+	cbuffer->head++;
+	return 1;
 }
 
 /* Removes all items in the buffer */
 void clear_cbuffer_t (cbuffer_t* cbuffer) { 
-	cbuffer->size = 0; 
 	cbuffer->head = 0;
+	cbuffer->tail = 0;
 }
 
 /* Returns the first element in the buffer */
-char* head_cbuffer_t ( cbuffer_t* cbuffer )
+void* head_cbuffer_t ( cbuffer_t* cbuffer )
 {
-	if ( cbuffer->size !=0 )
-		return &cbuffer->data[cbuffer->head];
+	if ( !is_empty_cbuffer_t(cbuffer) )
+		return slot(cbuffer,cbuffer->head);
 	else{
 		return NULL;
 	}
 }
 
+/* Free slots after the last element */
+int reserve_cbuffer_t ( cbuffer_t* cbuffer, cbuffer_region_t* region, int nr_items)
+{
+	unsigned int tail=cbuffer->tail;
+	unsigned int head=load_acquire(&cbuffer->head);
+	int nr_gaps=cbuffer->max_size-(tail-head);
+	
+	if (nr_items>nr_gaps)
+		nr_items=nr_gaps;
+	if (nr_items<0)
+		nr_items=0;
+	
+	fill_region(cbuffer,region,tail,nr_items);
+	return nr_items;
+}
 
+/* Publishes the items written into the reserved slots */
+void commit_cbuffer_t ( cbuffer_t* cbuffer, int nr_items)
+{
+	store_release(&cbuffer->tail,cbuffer->tail+nr_items);
+}
 
+/* Elements at the head of the buffer */
+int peek_cbuffer_t ( cbuffer_t* cbuffer, cbuffer_region_t* region, int nr_items)
+{
+	unsigned int head=cbuffer->head;
+	unsigned int tail=load_acquire(&cbuffer->tail);
+	int size=tail-head;
+	
+	if (nr_items>size)
+		nr_items=size;
+	if (nr_items<0)
+		nr_items=0;
+	
+	fill_region(cbuffer,region,head,nr_items);
+	return nr_items;
+}
+
+/* Gives the slots of the elements read back to the producer */
+void consume_cbuffer_t ( cbuffer_t* cbuffer, int nr_items)
+{
+	store_release(&cbuffer->head,cbuffer->head+nr_items);
+}
+
+/* SPSC: inserts an item if there is room for it */
+int spsc_insert_cbuffer_t ( cbuffer_t* cbuffer, const void* new_item )
+{
+	return spsc_insert_items_cbuffer_t(cbuffer,new_item,1);
+}
+
+/* SPSC: inserts as many items as fit in the buffer */
+int spsc_insert_items_cbuffer_t ( cbuffer_t* cbuffer, const void* items, int nr_items)
+{
+	unsigned int tail=cbuffer->tail; /* Only the producer writes it */
+	/* Pairs with the release in spsc_remove_items_cbuffer_t(): the consumer is done with the slots */
+	unsigned int head=load_acquire(&cbuffer->head);
+	int nr_gaps=cbuffer->max_size-(tail-head);
+	
+	if (nr_items>nr_gaps)
+		nr_items=nr_gaps;
+	if (nr_items<=0)
+		return 0;
+	
+	copy_in(cbuffer,tail,items,nr_items);
+	/* Publish the items after they have been written */
+	store_release(&cbuffer->tail,tail+nr_items);
+	return nr_items;
+}
+
+/* SPSC: removes the first element if there is one */
+int spsc_remove_cbuffer_t ( cbuffer_t* cbuffer, void* item )
+{
+	return spsc_remove_items_cbuffer_t(cbuffer,item,1);
+}
+
+/* SPSC: removes as many items as available, up to nr_items */
+int spsc_remove_items_cbuffer_t ( cbuffer_t* cbuffer, void* items, int nr_items)
+{
+	unsigned int head=cbuffer->head; /* Only the consumer writes it */
+	/* Pairs with the release in spsc_insert_items_cbuffer_t(): the items are visible */
+	unsigned int tail=load_acquire(&cbuffer->tail);
+	int size=tail-head;
+	
+	if (nr_items>size)
+		nr_items=size;
+	if (nr_items<=0)
+		return 0;
+	
+	copy_out(cbuffer,head,items,nr_items);
+	/* Give the slots back to the producer once they have been read */
+	store_release(&cbuffer->head,head+nr_items);
+	return nr_items;
+}
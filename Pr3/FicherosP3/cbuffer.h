@@ -4,16 +4,27 @@
 
 typedef struct
 {
-    char* data;			/* raw byte vector */
-	unsigned int head;		/* Index of the first element // head in [0 .. max_size-1] */
-	unsigned int size;		/* Current Buffer size // size in [0 .. max_size] */
-	unsigned int max_size;  	/* Buffer max capacity */
+    char* data;			/* raw byte vector (max_size*item_size bytes) */
+	unsigned int head;		/* Number of elements removed so far (free-running) */
+	unsigned int tail;		/* Number of elements inserted so far (free-running) */
+	unsigned int max_size;  	/* Buffer max capacity, a power of two */
+	unsigned int item_size;		/* Size in bytes of each element */
 }
 cbuffer_t;
 
+/* Elements of the buffer that are contiguous in memory. A region crosses the
+   end of the data vector at most once, so it is made of up to two parts */
+typedef struct
+{
+	void* ptr[2];			/* Start of each part */
+	unsigned int len[2];		/* Elements in each part (len[1] is 0 if there is no wrap) */
+}
+cbuffer_region_t;
+
 /* Operations supported by cbuffer_t */
-/* Creates a new cbuffer (takes care of allocating memory) */
-cbuffer_t* create_cbuffer_t (unsigned int max_size);
+/* Creates a new cbuffer of elements of item_size bytes (takes care of allocating memory).
+   The capacity is max_size rounded up to a power of two */
+cbuffer_t* create_cbuffer_t (unsigned int max_size, unsigned int item_size);
 
 /* Release memory from circular buffer  */
 void destroy_cbuffer_t ( cbuffer_t* cbuffer );
@@ -30,22 +41,63 @@ int is_full_cbuffer_t ( cbuffer_t* cbuffer );
 /* Returns a non-zero value when buffer is empty */
 int is_empty_cbuffer_t ( cbuffer_t* cbuffer );
 
-/* Inserts an item at the end of the buffer */
-void insert_cbuffer_t ( cbuffer_t* cbuffer, char new_item );
+/* Inserts a copy of *new_item at the end of the buffer (overwrites the first one if full) */
+void insert_cbuffer_t ( cbuffer_t* cbuffer, const void* new_item );
 
 /* Inserts nr_items into the buffer */
-void insert_items_cbuffer_t ( cbuffer_t* cbuffer, const char* items, int nr_items);
+void insert_items_cbuffer_t ( cbuffer_t* cbuffer, const void* items, int nr_items);
 
-/* Removes the first element in the buffer and returns a copy of it */
-char remove_cbuffer_t ( cbuffer_t* cbuffer);
+/* Removes the first element in the buffer and stores a copy of it in *item (unless NULL).
+   Returns 0 if the buffer was empty */
+int remove_cbuffer_t ( cbuffer_t* cbuffer, void* item);
 
 /* Removes nr_items from the buffer and returns a copy of them */
-void remove_items_cbuffer_t ( cbuffer_t* cbuffer, char* items, int nr_items);
+void remove_items_cbuffer_t ( cbuffer_t* cbuffer, void* items, int nr_items);
 
 /* Removes all items in the buffer */
 void clear_cbuffer_t (cbuffer_t* cbuffer);
 
 /* Returns a pointer to the first element in the buffer */
-char* head_cbuffer_t ( cbuffer_t* cbuffer );
+void* head_cbuffer_t ( cbuffer_t* cbuffer );
+
+/*
+ * Zero-copy access to the buffer memory. The caller fills (or reads) the
+ * region in place, e.g. with copy_from_user()/copy_to_user(), and then
+ * commits (or consumes) the items it actually used. Like the SPSC
+ * functions below, one producer and one consumer may use them at the
+ * same time without a lock.
+ */
+
+/* Hands out up to nr_items free slots after the last element. Returns the number of slots in *region */
+int reserve_cbuffer_t ( cbuffer_t* cbuffer, cbuffer_region_t* region, int nr_items);
+
+/* Appends the first nr_items slots handed out by reserve_cbuffer_t() to the buffer */
+void commit_cbuffer_t ( cbuffer_t* cbuffer, int nr_items);
+
+/* Hands out up to nr_items elements from the head, without removing them. Returns the number of items in *region */
+int peek_cbuffer_t ( cbuffer_t* cbuffer, cbuffer_region_t* region, int nr_items);
+
+/* Removes the first nr_items elements handed out by peek_cbuffer_t() */
+void consume_cbuffer_t ( cbuffer_t* cbuffer, int nr_items);
+
+/*
+ * Lock-free operations for a single producer and a single consumer (SPSC).
+ * The producer only writes 'tail' and the consumer only writes 'head', so
+ * one thread may insert while another one removes without any lock.
+ * They never overwrite items and must not be mixed with the functions
+ * above while both sides are running.
+ */
+
+/* Inserts a copy of *new_item if there is room for it. Returns 1 on success, 0 if full */
+int spsc_insert_cbuffer_t ( cbuffer_t* cbuffer, const void* new_item );
+
+/* Inserts up to nr_items into the buffer. Returns the number of items inserted */
+int spsc_insert_items_cbuffer_t ( cbuffer_t* cbuffer, const void* items, int nr_items);
+
+/* Removes the first element into *item. Returns 1 on success, 0 if empty */
+int spsc_remove_cbuffer_t ( cbuffer_t* cbuffer, void* item );
+
+/* Removes up to nr_items from the buffer. Returns the number of items removed */
+int spsc_remove_items_cbuffer_t ( cbuffer_t* cbuffer, void* items, int nr_items);
 
 #endif
@@ -3,16 +3,18 @@
 #include <linux/proc_fs.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
-#include <linux/vmalloc.h>
 #include <asm-generic/uaccess.h>
 #include <asm-generic/errno.h>
 #include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/atomic.h>
 #include <linux/kfifo.h>
 
 MODULE_LICENSE("GPL");
 
 #define MAX_ITEMS_FIFO 64
-#define MAX_KBUF 128
 
 static struct proc_dir_entry *proc_entry;
 static struct kfifo fifobuff; /* buffer circular de linux */
@@ -20,12 +22,64 @@ int prod_count = 0; /* Número de procesos que abrieron la entrada
 					   /proc para escritura (productores) */
 int cons_count = 0; /* Número de procesos que abrieron la entrada
 					   /proc para lectura (consumidores) */
-struct semaphore mtx; /* para garantizar Exclusión Mutua */
-struct semaphore sem_prod; /* cola de espera para productor(es) */
-struct semaphore sem_cons; /* cola de espera para consumidor(es) */
-int nr_prod_waiting=0; /* Número de procesos productores esperando */
-int nr_cons_waiting=0; /* Número de procesos consumidores esperando */
+struct semaphore mtx; /* para garantizar Exclusión Mutua en open() y close() */
+DEFINE_MUTEX(read_mtx); /* serializa a los consumidores en modo con cerrojos */
+DEFINE_MUTEX(write_mtx); /* serializa a los productores en modo con cerrojos */
+DECLARE_WAIT_QUEUE_HEAD(wq_prod); /* cola de espera para productor(es) */
+DECLARE_WAIT_QUEUE_HEAD(wq_cons); /* cola de espera para consumidor(es) */
+
+/* Con un único productor y un único consumidor kfifo no necesita cerrojos:
+   cada lado sólo modifica su índice. En ese caso (modo SPSC) read() y write()
+   no toman read_mtx/write_mtx y no comparten ningún cerrojo entre sí.
+   Cada cambio de modo se anota en el registro del kernel (update_mode()).
+   Nota: un mismo descriptor no debe usarse desde varios hilos a la vez, ya
+   que cuenta como un solo productor o consumidor */
+static int spsc = 0;
+
+/* Operaciones en curso en modo SPSC de cada lado, para poder volver al modo
+   con cerrojos sin que quede ninguna a medias */
+static atomic_t readers_inflight = ATOMIC_INIT(0);
+static atomic_t writers_inflight = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(wq_mode);
+
+/* Intenta entrar en el camino sin cerrojos. Devuelve 0 si hay que usar el
+   cerrojo del lado. El incremento se hace antes de consultar el modo (y
+   update_mode() cambia el modo antes de consultar el contador), así que o
+   bien se ve el cambio de modo o bien update_mode() espera a esta operación */
+static inline int spsc_enter(atomic_t *inflight){
+	atomic_inc(inflight);
+	smp_mb__after_atomic();
+	if (READ_ONCE(spsc))
+		return 1;
+	atomic_dec(inflight);
+	return 0;
+}
+
+static inline void spsc_exit(atomic_t *inflight){
+	if (atomic_dec_and_test(inflight) && !READ_ONCE(spsc))
+		wake_up(&wq_mode);
+}
+
+/* Activa el modo SPSC si hay exactamente un productor y un consumidor, o
+   vuelve al modo con cerrojos en otro caso. Se invoca con mtx adquirido */
+static void update_mode(void){
+	int want = (prod_count==1 && cons_count==1);
 
+	if (want == spsc)
+		return;
+
+	WRITE_ONCE(spsc, want);
+
+	if (!want) {
+		smp_mb();
+		/* Los procesos bloqueados sin cerrojo se despiertan y reintentan con él */
+		wake_up_interruptible(&wq_prod);
+		wake_up_interruptible(&wq_cons);
+		wait_event(wq_mode, atomic_read(&readers_inflight)==0 && atomic_read(&writers_inflight)==0);
+	}
+
+	printk(KERN_INFO "modfifo: modo %s\n", want ? "SPSC (sin cerrojos)" : "con cerrojos");
+}
 
 /* Se invoca al hacer open() de entrada /proc */
 static int fifoproc_open(struct inode *inode, struct file *file) {
@@ -37,59 +91,51 @@ static int fifoproc_open(struct inode *inode, struct file *file) {
 	if (file->f_mode & FMODE_READ) {
 		// un consumidor abrió el fifo
 		cons_count++;
-		
-		if (nr_prod_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_prod);
-			nr_prod_waiting--;
-		}
+		update_mode();
+
+		/* Despierta a los productores que esperan un consumidor */
+		wake_up_interruptible(&wq_prod);
 
 		while (prod_count==0) {
-			nr_cons_waiting++;
 			up(&mtx); /* "Libera" el mutex */
-			
+
 			/* Se bloquea en la cola */
-			if (down_interruptible(&sem_cons)){
+			if (wait_event_interruptible(wq_cons, READ_ONCE(prod_count)>0)){
 				down(&mtx);
-				nr_cons_waiting--;
+				cons_count--;
+				update_mode();
 				up(&mtx);
-				
+
 				return -EINTR;
 			}
-			
-			/* "Adquiere" el mutex */
-			if (down_interruptible(&mtx))
-				return -EINTR;
 
+			/* "Adquiere" el mutex */
+			down(&mtx);
 		}
 
 	} else {
 		// un productor abrió el fifo
 		prod_count++;
+		update_mode();
 
-		if (nr_cons_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_cons);
-			nr_cons_waiting--;
-		}
+		/* Despierta a los consumidores que esperan un productor */
+		wake_up_interruptible(&wq_cons);
 
 		while (cons_count==0) {
-			nr_prod_waiting++;
 			up(&mtx); /* "Libera" el mutex */
-			
+
 			/* Se bloquea en la cola */
-			if (down_interruptible(&sem_prod)){
+			if (wait_event_interruptible(wq_prod, READ_ONCE(cons_count)>0)){
 				down(&mtx);
-				nr_prod_waiting--;
+				prod_count--;
+				update_mode();
 				up(&mtx);
-				
+
 				return -EINTR;
 			}
-			
-			/* "Adquiere" el mutex */
-			if (down_interruptible(&mtx))
-				return -EINTR;
 
+			/* "Adquiere" el mutex */
+			down(&mtx);
 		}
 	}
 
@@ -101,30 +147,23 @@ static int fifoproc_open(struct inode *inode, struct file *file) {
 
 /* Se invoca al hacer close() de entrada /proc */
 static int fifoproc_release(struct inode *inode, struct file *file){
-	if (down_interruptible(&mtx))
-		return -EINTR;
+	down(&mtx);
 
 	if (file->f_mode & FMODE_READ) {
 		// un consumidor cerró el fifo
 		cons_count--;
-		/* Despertar a posible productor bloqueado */
-		if (nr_prod_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_prod);
-			nr_prod_waiting--;
-		}
+		/* Despertar a posibles productores bloqueados */
+		wake_up_interruptible(&wq_prod);
 
 	} else {
 		// un productor cerró el fifo
 		prod_count--;
-		/* Despertar a posible consumidor bloqueado */
-		if (nr_cons_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_cons);
-			nr_cons_waiting--;
-		}
+		/* Despertar a posibles consumidores bloqueados */
+		wake_up_interruptible(&wq_cons);
 	}
 
+	update_mode();
+
 	if (cons_count == 0 && prod_count == 0)
 		kfifo_reset(&fifobuff);
 
@@ -135,109 +174,101 @@ static int fifoproc_release(struct inode *inode, struct file *file){
 
 /* Se invoca al hacer read() de entrada /proc */
 static ssize_t fifoproc_read(struct file *filp, char __user *buff, size_t len, loff_t *off){
-	char kbuffer[MAX_KBUF]="";
-	int leido;
-        
-	if (len> MAX_ITEMS_FIFO || len> MAX_KBUF) { return -ENOSPC;}
+	unsigned int copied;
+	int lockless;
+	ssize_t ret;
 
-	if (down_interruptible(&mtx))
+	if (len> MAX_ITEMS_FIFO) { return -ENOSPC;}
+
+retry:
+	lockless = spsc_enter(&readers_inflight);
+	if (!lockless && mutex_lock_interruptible(&read_mtx))
 		return -EINTR;
 
-	/* Esperar hasta que haya un dato para consumir (debe haber productores) */
-	while (kfifo_len(&fifobuff)<len && prod_count>0){
-		nr_cons_waiting++;
-		up(&mtx); /* "Libera" el mutex */
-		
-		/* Se bloquea en la cola */
-		if (down_interruptible(&sem_cons)){
-			down(&mtx);
-			nr_cons_waiting--;
-			up(&mtx);
-			
-			return -EINTR;
-		}
-		
-		/* "Adquiere" el mutex */
-		if (down_interruptible(&mtx))
-			return -EINTR;
+	/* Esperar hasta que haya datos para consumir (debe haber productores) */
+	if (wait_event_interruptible(wq_cons, kfifo_len(&fifobuff)>=len || READ_ONCE(prod_count)==0 ||
+				     (lockless && !READ_ONCE(spsc)))) {
+		ret = -EINTR;
+		goto out;
+	}
+
+	/* Se abandonó el modo SPSC mientras esperaba: reintentar con cerrojo */
+	if (lockless && !READ_ONCE(spsc)) {
+		spsc_exit(&readers_inflight);
+		goto retry;
 	}
 
 	/* Detectar fin de comunicación por error (productor cierra FIFO antes) */
-	if (prod_count==0 && kfifo_is_empty(&fifobuff)) {up(&mtx); return 0;}
+	if (READ_ONCE(prod_count)==0 && kfifo_is_empty(&fifobuff)) {ret = 0; goto out;}
 
-	// leer kfifo
-	leido = kfifo_out(&fifobuff,kbuffer,len);
+	/* Copia directa del kfifo al buffer de usuario */
+	if (kfifo_to_user(&fifobuff, buff, len, &copied)) {ret = -EFAULT; goto out;}
 
 	/* Despertar a posible productor bloqueado */
-	if (nr_prod_waiting>0) {
-		/* Despierta a uno de los hilos bloqueados */
-		up(&sem_prod);
-		nr_prod_waiting--;
-	}
-
-	up(&mtx); 
-	// USAR OUT_TO_USER
-	if (copy_to_user(buff, kbuffer, len)) { return -EINVAL;}
-	(*off)+=len;
-	return len;
+	if (wq_has_sleeper(&wq_prod))
+		wake_up_interruptible(&wq_prod);
+
+	(*off)+=copied;
+	ret = copied;
+out:
+	if (lockless)
+		spsc_exit(&readers_inflight);
+	else
+		mutex_unlock(&read_mtx);
+	return ret;
 }
 
 /* Se invoca al hacer write() de entrada /proc */
 static ssize_t fifoproc_write(struct file *filp, const char __user *buff, size_t len, loff_t *off){
-	char kbuffer[MAX_KBUF]="";
-	int escrito;
+	unsigned int copied;
+	int lockless;
+	ssize_t ret;
 
-	/*if (off>0)
-		return 0;*/
+	if (len> MAX_ITEMS_FIFO) { return -ENOSPC;}
 
-	if (len> MAX_ITEMS_FIFO || len> MAX_KBUF) { return -ENOSPC;}
-	if (copy_from_user(kbuffer,buff,len)) { return -EFAULT;} // USAR OUT TO USER
-	kbuffer[len] = '\0';
-	*off += len;
-
-	if (down_interruptible(&mtx))
+retry:
+	lockless = spsc_enter(&writers_inflight);
+	if (!lockless && mutex_lock_interruptible(&write_mtx))
 		return -EINTR;
 
 	/* Esperar hasta que haya hueco para insertar (debe haber consumidores) */
-	while (kfifo_avail(&fifobuff)<len && cons_count>0){
-		nr_prod_waiting++;
-		up(&mtx); /* "Libera" el mutex */
-		
-		/* Se bloquea en la cola */
-		if (down_interruptible(&sem_prod)){
-			down(&mtx);
-			nr_prod_waiting--;
-			up(&mtx);
-			
-			return -EINTR;
-		}
-		
-		/* "Adquiere" el mutex */
-		if (down_interruptible(&mtx))
-			return -EINTR;
+	if (wait_event_interruptible(wq_prod, kfifo_avail(&fifobuff)>=len || READ_ONCE(cons_count)==0 ||
+				     (lockless && !READ_ONCE(spsc)))) {
+		ret = -EINTR;
+		goto out;
+	}
+
+	/* Se abandonó el modo SPSC mientras esperaba: reintentar con cerrojo */
+	if (lockless && !READ_ONCE(spsc)) {
+		spsc_exit(&writers_inflight);
+		goto retry;
 	}
 
 	/* Detectar fin de comunicación por error (consumidor cierra FIFO antes) */
-	if (cons_count==0) {up(&mtx); return -EPIPE;}
+	if (READ_ONCE(cons_count)==0) {ret = -EPIPE; goto out;}
 
-	escrito = kfifo_in(&fifobuff,kbuffer,len);
+	/* Copia directa del buffer de usuario al kfifo */
+	if (kfifo_from_user(&fifobuff, buff, len, &copied)) {ret = -EFAULT; goto out;}
 
 	/* Despertar a posible consumidor bloqueado */
-	if (nr_cons_waiting>0) {
-		/* Despierta a uno de los hilos bloqueados */
-		up(&sem_cons);
-		nr_cons_waiting--;
-	}
-
-	up(&mtx); 
-	return len;
+	if (wq_has_sleeper(&wq_cons))
+		wake_up_interruptible(&wq_cons);
+
+	*off += copied;
+	ret = copied;
+out:
+	if (lockless)
+		spsc_exit(&writers_inflight);
+	else
+		mutex_unlock(&write_mtx);
+	return ret;
 }
 
 static const struct file_operations proc_entry_fops = {
     .open = fifoproc_open,
     .release = fifoproc_release,
     .read = fifoproc_read,
-    .write = fifoproc_write,    
+    .write = fifoproc_write,
 };
 
 /* Funciones de inicialización y descarga del módulo */
@@ -251,8 +282,6 @@ int init_fifoproc_module(void){
 	}
 
 	sema_init(&mtx, 1);
-	sema_init(&sem_prod, 0);
-	sema_init(&sem_cons, 0);
 
 	proc_entry = proc_create("modfifo",0666, NULL, &proc_entry_fops);
 	if (proc_entry == NULL) {
@@ -3,6 +3,7 @@
 #include <linux/proc_fs.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <asm-generic/uaccess.h>
 #include <linux/list.h>
 #include <linux/spinlock.h>
@@ -13,6 +14,7 @@ MODULE_LICENSE("GPL");
 DEFINE_SPINLOCK(sp);
 
 static struct proc_dir_entry *proc_entry;
+static struct proc_dir_entry *proc_stats_entry;
 
 /* Nodos de la lista */
 typedef struct list_item {
@@ -21,18 +23,25 @@ typedef struct list_item {
 } list_item_t;
 
 struct list_head mylist; /* Lista enlazada. OJO todos los demás nodos están en memoria dinámica. */
+static struct kmem_cache *item_cache; /* Cache slab para los nodos de la lista */
+static atomic_t items_in_use = ATOMIC_INIT(0);
 
 static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
 static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off);
-static void modlist_add(int num);
+static int modlist_add(int num);
 static void modlist_remove(int num);
 static void modlist_cleanup(void);
+static ssize_t modlist_stats_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
 
 static const struct file_operations proc_entry_fops = {
     .read = modlist_read,
     .write = modlist_write,    
 };
 
+static const struct file_operations proc_stats_fops = {
+    .read = modlist_stats_read,
+};
+
 int init_modlist_module( void )
 {
   int ret = 0;
@@ -43,10 +52,22 @@ int init_modlist_module( void )
     ret = -ENOMEM;
   } else {
 
+    item_cache = kmem_cache_create("modlist_item", sizeof(struct list_item), 0, 0, NULL);
+    if (item_cache == NULL) {
+      printk(KERN_INFO "modlist: Can't create slab cache\n");
+      return -ENOMEM;
+    }
+
     proc_entry = proc_create( "modlist", 0666, NULL, &proc_entry_fops);
-    if (proc_entry == NULL) {
+    proc_stats_entry = proc_create( "modlist_stats", 0444, NULL, &proc_stats_fops);
+    if (proc_entry == NULL || proc_stats_entry == NULL) {
       ret = -ENOMEM;
       printk(KERN_INFO "modlist: Can't create /proc entry\n");
+      if (proc_entry)
+        remove_proc_entry("modlist", NULL);
+      if (proc_stats_entry)
+        remove_proc_entry("modlist_stats", NULL);
+      kmem_cache_destroy(item_cache);
     } else {
       printk(KERN_INFO "modlist: Module loaded\n");
     }
@@ -59,8 +80,10 @@ int init_modlist_module( void )
 void exit_modlist_module( void )
 {
   remove_proc_entry("modlist", NULL);
+  remove_proc_entry("modlist_stats", NULL);
   //vfree(&mylist); LA CABEZA NO ESTÁ EN MEMORIA DINÁMICA, CON HACER UN CLEANUP VALE
   modlist_cleanup(); // <- porque los demás nodos sí están en memoria dinámica pero mylist en la pila
+  kmem_cache_destroy(item_cache);
   
   printk(KERN_INFO "modlist: Module unloaded.\n");
 }
@@ -121,7 +144,8 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
   modlistbuffer[len] = '\0'; /* Add the `\0' */ 
 
   if(sscanf(modlistbuffer, "add %i", &num) == 1) {
-    modlist_add(num);
+    if (modlist_add(num))
+      return -ENOMEM;
 	}
   else if(sscanf(modlistbuffer, "remove %i", &num) == 1) {
     modlist_remove(num);
@@ -135,14 +159,19 @@ static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t l
   return len;
 }
 
-static void modlist_add(int num) {
-  struct list_item* nodo = vmalloc(sizeof(struct list_item));
-  
+static int modlist_add(int num) {
+  struct list_item* nodo = kmem_cache_alloc(item_cache, GFP_KERNEL);
+
+  if (nodo == NULL)
+    return -ENOMEM;
+
+  atomic_inc(&items_in_use);
   nodo->data = num;
 
   spin_lock(&sp);
   list_add_tail(&nodo->links,&mylist);
   spin_unlock(&sp); 
+  return 0;
 }
 
 static void modlist_remove(int num) {
@@ -156,7 +185,8 @@ static void modlist_remove(int num) {
 
   	if(item->data == num) {
   		list_del(cur_node);
-        vfree(item);
+        kmem_cache_free(item_cache, item);
+        atomic_dec(&items_in_use);
     }
   }
   spin_unlock(&sp); 
@@ -172,11 +202,33 @@ static void modlist_cleanup(void) {
     item = list_entry(cur_node, struct list_item, links);
 
     list_del(cur_node);
-    vfree(item);
+    kmem_cache_free(item_cache, item);
+    atomic_dec(&items_in_use);
   }
   spin_unlock(&sp);
 }
 
+static ssize_t modlist_stats_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+  char statsbuffer[64];
+  ssize_t buf_length = 0;
+
+  if ((*off) > 0) /* Tell the application that there is nothing left to read */
+    return 0;
+
+  buf_length += sprintf(statsbuffer, "items_in_use=%d\n", atomic_read(&items_in_use));
+
+  if (len < buf_length)
+    return -ENOSPC;
+
+  /* Transfer data from the kernel to userspace  */
+  if (copy_to_user(buf, statsbuffer, buf_length))
+    return -EFAULT;
+
+  (*off)+=buf_length;  /* Update the file pointer */
+
+  return buf_length;
+}
+
 
 module_init( init_modlist_module );
 module_exit( exit_modlist_module );
@@ -0,0 +1 @@
+../FicherosP3/cbuffer.c
\ No newline at end of file
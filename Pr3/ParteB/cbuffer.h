@@ -0,0 +1 @@
+../FicherosP3/cbuffer.h
\ No newline at end of file
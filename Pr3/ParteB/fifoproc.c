@@ -3,229 +3,764 @@
 #include <linux/proc_fs.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/list.h>
 #include <asm-generic/uaccess.h>
 #include <asm-generic/errno.h>
-#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
+#include <linux/splice.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/highmem.h>
 #include "cbuffer.h"
-
-#define MAX_ITEMS_CBUF 50
-#define MAX_KBUF 100
-
-static struct proc_dir_entry *proc_entry;
-cbuffer_t* cbuffer; /* Buffer circular */
-int prod_count = 0; /* Número de procesos que abrieron la entrada
+#include "fifoproc_ioctl.h"
+
+#define DEFAULT_FIFO_SIZE 4096
+#define MAX_FIFO_SIZE (4*1024*1024) /* vmalloc() de cada FIFO acotado a 4 MiB */
+#define BUFFER_LENGTH 64
+#define FIFO_NAME_LENGTH 20
+#define MODE_LENGTH 16
+/* Cabecera que precede a cada mensaje en el buffer de un FIFO en modo mensaje */
+#define RECORD_HDR sizeof(u32)
+
+/* Capacidad del buffer circular en bytes (se redondea a potencia de dos) */
+static unsigned int fifo_size = DEFAULT_FIFO_SIZE;
+module_param(fifo_size, uint, 0444);
+MODULE_PARM_DESC(fifo_size, "Capacidad de cada FIFO en bytes (por defecto 4096, máximo 4 MiB)");
+
+/* Un FIFO con nombre: /proc/modfifo/<name>. Cada uno tiene su propio
+   buffer, cerrojo y colas de espera, de modo que los FIFOs no comparten nada */
+typedef struct {
+	cbuffer_t* cbuffer; /* Buffer circular */
+	int prod_count; /* Número de procesos que abrieron la entrada
 					   /proc para escritura (productores) */
-int cons_count = 0; /* Número de procesos que abrieron la entrada
+	int cons_count; /* Número de procesos que abrieron la entrada
 					   /proc para lectura (consumidores) */
-struct semaphore mtx; /* para garantizar Exclusión Mutua */
-struct semaphore sem_prod; /* cola de espera para productor(es) */
-struct semaphore sem_cons; /* cola de espera para consumidor(es) */
-int nr_prod_waiting=0; /* Número de procesos productores esperando */
-int nr_cons_waiting=0; /* Número de procesos consumidores esperando */
+	int removed; /* El FIFO se está borrando: no admite más operaciones */
+	int record; /* Modo mensaje: cada write() es un mensaje y cada read() devuelve uno */
+	struct mutex mtx; /* para garantizar Exclusión Mutua */
+	wait_queue_head_t wq_prod; /* cola de espera para productor(es) */
+	wait_queue_head_t wq_cons; /* cola de espera para consumidor(es) */
+	struct proc_dir_entry* proc_entry;
+	struct list_head links; /* nodo en la lista fifos */
+	char name[FIFO_NAME_LENGTH];
+} fifo_t;
+
+static struct proc_dir_entry *proc_dir; /* /proc/modfifo */
+static struct proc_dir_entry *proc_control_entry; /* /proc/modfifo/control */
+static LIST_HEAD(fifos); /* FIFOs creados */
+static DEFINE_MUTEX(fifos_mtx); /* protege la lista fifos */
+
+/* Espera en la cola wq hasta que se cumpla cond. Se invoca con el mutex
+   del FIFO adquirido y lo libera mientras duerme. Cada proceso evalúa su
+   propia condición al despertar, de modo que un wake_up() sólo deja
+   continuar a los que pueden avanzar. Devuelve -EINTR (con el mutex
+   libre) si llega una señal */
+#define wait_with_mutex(fifo,wq,cond) \
+({ \
+	int __ret=0; \
+	while (!(cond)) { \
+		mutex_unlock(&(fifo)->mtx); \
+		if (wait_event_interruptible((fifo)->wq,cond) || mutex_lock_interruptible(&(fifo)->mtx)) { \
+			__ret=-EINTR; \
+			break; \
+		} \
+	} \
+	__ret; \
+})
+
+static const struct file_operations proc_entry_fops;
+
+/* Busca un FIFO por nombre. Se invoca con fifos_mtx adquirido */
+static fifo_t* lookup_fifo(const char* name){
+	fifo_t* fifo;
+
+	list_for_each_entry(fifo, &fifos, links) {
+		if (strcmp(fifo->name, name) == 0)
+			return fifo;
+	}
+	return NULL;
+}
+
+/* Crea /proc/modfifo/<name>, en modo mensaje si record!=0 */
+static int fifo_create(const char* name, int record){
+	fifo_t* fifo;
+	int ret=0;
+
+	fifo = kzalloc(sizeof(fifo_t), GFP_KERNEL);
+	if (!fifo)
+		return -ENOMEM;
+
+	fifo->cbuffer = create_cbuffer_t(fifo_size,sizeof(char));
+	if (!fifo->cbuffer) {
+		kfree(fifo);
+		return -ENOMEM;
+	}
+
+	mutex_init(&fifo->mtx);
+	init_waitqueue_head(&fifo->wq_prod);
+	init_waitqueue_head(&fifo->wq_cons);
+	strncpy(fifo->name, name, FIFO_NAME_LENGTH-1);
+	fifo->record = record;
+
+	mutex_lock(&fifos_mtx);
+
+	if (lookup_fifo(fifo->name)) {
+		ret = -EEXIST;
+		goto out_free;
+	}
+
+	fifo->proc_entry = proc_create_data(fifo->name, 0666, proc_dir, &proc_entry_fops, fifo);
+	if (!fifo->proc_entry) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	list_add_tail(&fifo->links, &fifos);
+	mutex_unlock(&fifos_mtx);
+	return 0;
+
+out_free:
+	mutex_unlock(&fifos_mtx);
+	destroy_cbuffer_t(fifo->cbuffer);
+	kfree(fifo);
+	return ret;
+}
 
+/* Borra un FIFO, que ya no está en la lista fifos. Los procesos bloqueados
+   en él se despiertan y terminan (fin de fichero o EPIPE) antes de que
+   remove_proc_entry() cierre los ficheros abiertos */
+static void fifo_destroy(fifo_t* fifo){
+	mutex_lock(&fifo->mtx);
+	fifo->removed = 1;
+	wake_up_interruptible(&fifo->wq_prod);
+	wake_up_interruptible(&fifo->wq_cons);
+	mutex_unlock(&fifo->mtx);
+
+	remove_proc_entry(fifo->name, proc_dir);
+	destroy_cbuffer_t(fifo->cbuffer);
+	kfree(fifo);
+}
+
+/* Borra /proc/modfifo/<name> */
+static int fifo_delete(const char* name){
+	fifo_t* fifo;
+
+	mutex_lock(&fifos_mtx);
+	fifo = lookup_fifo(name);
+	if (fifo)
+		list_del(&fifo->links);
+	mutex_unlock(&fifos_mtx);
+
+	if (!fifo)
+		return -ENOENT;
+
+	fifo_destroy(fifo);
+	return 0;
+}
 
 void cleanup_fifoproc_module(void){
-	destroy_cbuffer_t(cbuffer);
+	fifo_t *fifo, *tmp;
+
+	remove_proc_entry("control", proc_dir);
+
+	/* Borrar los FIFOs que queden */
+	list_for_each_entry_safe(fifo, tmp, &fifos, links) {
+		list_del(&fifo->links);
+		fifo_destroy(fifo);
+	}
+
 	remove_proc_entry("modfifo", NULL);
 	printk(KERN_INFO "modfifo: Module unloaded.\n");
 }
 
 /* Se invoca al hacer open() de entrada /proc */
 static int fifoproc_open(struct inode *inode, struct file *file) {
+	fifo_t* fifo = (fifo_t*)PDE_DATA(inode);
+
 	/* "Adquiere" el mutex */
-	if (down_interruptible(&mtx))
+	if (mutex_lock_interruptible(&fifo->mtx))
 		return -EINTR;
 
+	if (fifo->removed) {
+		mutex_unlock(&fifo->mtx);
+		return -ENOENT;
+	}
 
 	if (file->f_mode & FMODE_READ) {
 		// un consumidor abrió el fifo
-		cons_count++;
-		
-		if (nr_prod_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_prod);
-			nr_prod_waiting--;
-		}
-
-		while (prod_count==0) {
-			nr_cons_waiting++;
-			up(&mtx); /* "Libera" el mutex */
-			
-			/* Se bloquea en la cola */
-			if (down_interruptible(&sem_cons)){
-				down(&mtx);
-				nr_cons_waiting--;
-				up(&mtx);
-				
-				return -EINTR;
-			}
-			
-			/* "Adquiere" el mutex */
-			if (down_interruptible(&mtx))
-				return -EINTR;
-
+		fifo->cons_count++;
+		/* Despierta a los productores que esperan un consumidor */
+		wake_up_interruptible(&fifo->wq_prod);
+
+		/* Sin bloqueo, como en un FIFO con nombre, el consumidor no espera al productor */
+		if (!(file->f_flags & O_NONBLOCK) && wait_with_mutex(fifo,wq_cons,fifo->prod_count>0 || fifo->removed)) {
+			mutex_lock(&fifo->mtx);
+			fifo->cons_count--;
+			mutex_unlock(&fifo->mtx);
+			return -EINTR;
 		}
 
 	} else {
 		// un productor abrió el fifo
-		prod_count++;
-
-		if (nr_cons_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_cons);
-			nr_cons_waiting--;
+		fifo->prod_count++;
+		/* Despierta a los consumidores que esperan un productor */
+		wake_up_interruptible(&fifo->wq_cons);
+
+		/* Sin bloqueo el productor falla si no hay consumidores (ENXIO, como en un FIFO) */
+		if ((file->f_flags & O_NONBLOCK) && fifo->cons_count==0) {
+			fifo->prod_count--;
+			mutex_unlock(&fifo->mtx);
+			return -ENXIO;
 		}
 
-		while (cons_count==0) {
-			nr_prod_waiting++;
-			up(&mtx); /* "Libera" el mutex */
-			
-			/* Se bloquea en la cola */
-			if (down_interruptible(&sem_prod)){
-				down(&mtx);
-				nr_prod_waiting--;
-				up(&mtx);
-				
-				return -EINTR;
-			}
-			
-			/* "Adquiere" el mutex */
-			if (down_interruptible(&mtx))
-				return -EINTR;
-
+		if (wait_with_mutex(fifo,wq_prod,fifo->cons_count>0 || fifo->removed)) {
+			mutex_lock(&fifo->mtx);
+			fifo->prod_count--;
+			mutex_unlock(&fifo->mtx);
+			return -EINTR;
 		}
 	}
 
 	/* "Libera" el mutex */
-	up(&mtx);
+	mutex_unlock(&fifo->mtx);
 
 	return 0;
 }
 
 /* Se invoca al hacer close() de entrada /proc */
 static int fifoproc_release(struct inode *inode, struct file *file){
-	if (down_interruptible(&mtx))
-		return -EINTR;
+	fifo_t* fifo = (fifo_t*)PDE_DATA(inode);
+
+	mutex_lock(&fifo->mtx);
 
 	if (file->f_mode & FMODE_READ) {
 		// un consumidor cerró el fifo
-		cons_count--;
-		/* Despertar a posible productor bloqueado */
-		if (nr_prod_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_prod);
-			nr_prod_waiting--;
-		}
+		fifo->cons_count--;
+		/* Despertar a posibles productores bloqueados (detectan el fin si era el último) */
+		wake_up_interruptible(&fifo->wq_prod);
 
 	} else {
 		// un productor cerró el fifo
-		prod_count--;
-		/* Despertar a posible consumidor bloqueado */
-		if (nr_cons_waiting>0) {
-			/* Despierta a uno de los hilos bloqueados */
-			up(&sem_cons);
-			nr_cons_waiting--;
-		}
+		fifo->prod_count--;
+		/* Despertar a posibles consumidores bloqueados (detectan el fin si era el último) */
+		wake_up_interruptible(&fifo->wq_cons);
 	}
 
-	if (cons_count == 0 && prod_count == 0)
-		clear_cbuffer_t(cbuffer);
+	if (fifo->cons_count == 0 && fifo->prod_count == 0)
+		clear_cbuffer_t(fifo->cbuffer);
 
 	/* "Libera" el mutex */
-	up(&mtx);
+	mutex_unlock(&fifo->mtx);
 	return 0;
 }
 
-/* Se invoca al hacer read() de entrada /proc */
-static ssize_t fifoproc_read(struct file *filp, char __user *buff, size_t len, loff_t *off){
-	char kbuffer[MAX_KBUF]="";
-        
-	if (len> MAX_ITEMS_CBUF || len> MAX_KBUF) { return -ENOSPC;}
+/* Puntero al byte off de una región y bytes contiguos a partir de él */
+static char* region_ptr(cbuffer_region_t* region, unsigned int off, unsigned int* contig){
+	if (off < region->len[0]) {
+		*contig = region->len[0]-off;
+		return (char*)region->ptr[0]+off;
+	}
+	off -= region->len[0];
+	*contig = region->len[1]-off;
+	return (char*)region->ptr[1]+off;
+}
+
+/* Longitud del mensaje cuya cabecera empieza en el byte off de la región */
+static u32 region_get_len(cbuffer_region_t* region, unsigned int off){
+	u32 nr_bytes;
+	char* dst=(char*)&nr_bytes;
+	unsigned int i,contig;
+
+	/* La cabecera puede quedar partida al dar la vuelta el buffer */
+	for (i=0;i<RECORD_HDR;i++)
+		dst[i]=*region_ptr(region,off+i,&contig);
+	return nr_bytes;
+}
 
-	if (down_interruptible(&mtx))
+static void region_put_len(cbuffer_region_t* region, unsigned int off, u32 nr_bytes){
+	char* src=(char*)&nr_bytes;
+	unsigned int i,contig;
+
+	for (i=0;i<RECORD_HDR;i++)
+		*region_ptr(region,off+i,&contig)=src[i];
+}
+
+/* Copia len bytes de la región, a partir del byte off, a un buffer de usuario */
+static int region_to_user(char __user *buff, cbuffer_region_t* region, unsigned int off, unsigned int len){
+	unsigned int contig;
+	char* src;
+
+	while (len>0) {
+		src=region_ptr(region,off,&contig);
+		if (contig>len)
+			contig=len;
+		if (copy_to_user(buff,src,contig))
+			return -EFAULT;
+		buff+=contig;
+		off+=contig;
+		len-=contig;
+	}
+	return 0;
+}
+
+/* Copia len bytes de un buffer de usuario a la región, a partir del byte off */
+static int region_from_user(cbuffer_region_t* region, unsigned int off, const char __user *buff, unsigned int len){
+	unsigned int contig;
+	char* dst;
+
+	while (len>0) {
+		dst=region_ptr(region,off,&contig);
+		if (contig>len)
+			contig=len;
+		if (copy_from_user(dst,buff,contig))
+			return -EFAULT;
+		buff+=contig;
+		off+=contig;
+		len-=contig;
+	}
+	return 0;
+}
+
+/* Espera a que haya algún mensaje en un FIFO en modo mensaje. Se invoca con
+   el mutex adquirido; si devuelve error el mutex ya está libre */
+static int wait_for_records(fifo_t* fifo, struct file *filp){
+	if (filp->f_flags & O_NONBLOCK) {
+		if (is_empty_cbuffer_t(fifo->cbuffer) && fifo->prod_count>0 && !fifo->removed) {
+			mutex_unlock(&fifo->mtx);
+			return -EAGAIN;
+		}
+		return 0;
+	}
+	return wait_with_mutex(fifo,wq_cons,!is_empty_cbuffer_t(fifo->cbuffer) || fifo->prod_count==0 || fifo->removed);
+}
+
+/* read() en modo mensaje: devuelve exactamente un mensaje, o EMSGSIZE (sin
+   consumirlo) si no cabe en el buffer de usuario */
+static ssize_t fifoproc_read_record(fifo_t* fifo, struct file *filp, char __user *buff, size_t len){
+	cbuffer_t* cbuffer = fifo->cbuffer;
+	cbuffer_region_t region;
+	u32 nr_bytes;
+	int ret;
+
+	if (mutex_lock_interruptible(&fifo->mtx))
 		return -EINTR;
 
-	/* Esperar hasta que haya un dato para consumir (debe haber productores) */
-	while (size_cbuffer_t(cbuffer)<len && prod_count>0){
-		nr_cons_waiting++;
-		up(&mtx); /* "Libera" el mutex */
-		
-		/* Se bloquea en la cola */
-		if (down_interruptible(&sem_cons)){
-			down(&mtx);
-			nr_cons_waiting--;
-			up(&mtx);
-			
-			return -EINTR;
+	if ((ret=wait_for_records(fifo,filp)))
+		return ret;
+
+	/* Fin de comunicación: no quedan productores ni mensajes, o se borró el FIFO */
+	if (is_empty_cbuffer_t(cbuffer) || fifo->removed) {mutex_unlock(&fifo->mtx); return 0;}
+
+	/* Las escrituras son atómicas: en el buffer sólo hay mensajes completos */
+	peek_cbuffer_t(cbuffer,&region,size_cbuffer_t(cbuffer));
+	nr_bytes=region_get_len(&region,0);
+
+	if (nr_bytes>len) {mutex_unlock(&fifo->mtx); return -EMSGSIZE;}
+
+	if (region_to_user(buff,&region,RECORD_HDR,nr_bytes)) {mutex_unlock(&fifo->mtx); return -EFAULT;}
+	consume_cbuffer_t(cbuffer,RECORD_HDR+nr_bytes);
+
+	wake_up_interruptible(&fifo->wq_prod);
+	mutex_unlock(&fifo->mtx);
+	return nr_bytes;
+}
+
+/* write() en modo mensaje: el mensaje (con su cabecera) se inserta de una
+   vez, así que no puede superar la capacidad del buffer */
+static ssize_t fifoproc_write_record(fifo_t* fifo, struct file *filp, const char __user *buff, size_t len){
+	cbuffer_t* cbuffer = fifo->cbuffer;
+	cbuffer_region_t region;
+	size_t need=RECORD_HDR+len;
+
+	/* Un mensaje vacío no se distinguiría del fin de fichero */
+	if (len==0)
+		return 0;
+	if (need>cbuffer->max_size)
+		return -EMSGSIZE;
+
+	if (mutex_lock_interruptible(&fifo->mtx))
+		return -EINTR;
+
+	if (filp->f_flags & O_NONBLOCK) {
+		if (nr_gaps_cbuffer_t(cbuffer)<need && fifo->cons_count>0 && !fifo->removed) {mutex_unlock(&fifo->mtx); return -EAGAIN;}
+	}
+	else if (wait_with_mutex(fifo,wq_prod,nr_gaps_cbuffer_t(cbuffer)>=need || fifo->cons_count==0 || fifo->removed))
+		return -EINTR;
+
+	if (fifo->cons_count==0 || fifo->removed) {mutex_unlock(&fifo->mtx); return -EPIPE;}
+
+	/* Cabecera y datos se confirman juntos: si la copia falla no queda nada a medias */
+	reserve_cbuffer_t(cbuffer,&region,need);
+	region_put_len(&region,0,len);
+	if (region_from_user(&region,RECORD_HDR,buff,len)) {mutex_unlock(&fifo->mtx); return -EFAULT;}
+	commit_cbuffer_t(cbuffer,need);
+
+	wake_up_interruptible(&fifo->wq_cons);
+	mutex_unlock(&fifo->mtx);
+	return len;
+}
+
+/* FIFOPROC_IOC_READ_BATCH (ver fifoproc_ioctl.h): extrae de una vez todos los
+   mensajes completos que quepan. En el buffer ya tienen el formato de
+   struct fifoproc_record, así que se copian tal cual */
+static long fifoproc_ioctl(struct file *filp, unsigned int cmd, unsigned long arg){
+	fifo_t* fifo = (fifo_t*)PDE_DATA(filp->f_inode);
+	cbuffer_t* cbuffer = fifo->cbuffer;
+	cbuffer_region_t region;
+	struct fifoproc_ioc_batch batch;
+	unsigned int size,off=0,next;
+	long ret;
+
+	if (cmd != FIFOPROC_IOC_READ_BATCH || !fifo->record || !(filp->f_mode & FMODE_READ))
+		return -ENOTTY;
+
+	if (copy_from_user(&batch, (void __user *)arg, sizeof(batch)))
+		return -EFAULT;
+
+	batch.nr_msgs=0;
+
+	if (mutex_lock_interruptible(&fifo->mtx))
+		return -EINTR;
+
+	if ((ret=wait_for_records(fifo,filp)))
+		return ret;
+
+	if (!is_empty_cbuffer_t(cbuffer) && !fifo->removed) {
+		size=peek_cbuffer_t(cbuffer,&region,size_cbuffer_t(cbuffer));
+
+		/* Contar los mensajes que caben enteros */
+		while (off<size) {
+			next=off+RECORD_HDR+region_get_len(&region,off);
+			if (next>batch.len)
+				break;
+			off=next;
+			batch.nr_msgs++;
 		}
-		
-		/* "Adquiere" el mutex */
-		if (down_interruptible(&mtx))
-			return -EINTR;
+
+		if (batch.nr_msgs==0) {mutex_unlock(&fifo->mtx); return -EMSGSIZE;}
+
+		if (region_to_user((char __user *)(unsigned long)batch.data,&region,0,off)) {mutex_unlock(&fifo->mtx); return -EFAULT;}
+		consume_cbuffer_t(cbuffer,off);
+		wake_up_interruptible(&fifo->wq_prod);
 	}
 
-	/* Detectar fin de comunicación por error (productor cierra FIFO antes) */
-	if (prod_count==0 && is_empty_cbuffer_t(cbuffer)) {up(&mtx); return 0;}
+	mutex_unlock(&fifo->mtx);
+
+	if (copy_to_user((void __user *)arg, &batch, sizeof(batch)))
+		return -EFAULT;
+	return off;
+}
+
+/* Se invoca al hacer read() de entrada /proc.
+   Una lectura que cabe en el buffer espera a que haya len bytes; una mayor
+   devuelve lo que haya disponible (como mucho el contenido del buffer) */
+static ssize_t fifoproc_read(struct file *filp, char __user *buff, size_t len, loff_t *off){
+	fifo_t* fifo = (fifo_t*)PDE_DATA(filp->f_inode);
+	cbuffer_t* cbuffer = fifo->cbuffer;
+	cbuffer_region_t region;
+	size_t want=(len<=cbuffer->max_size)?len:1;
+
+	if (fifo->record)
+		return fifoproc_read_record(fifo,filp,buff,len);
+
+	if (len==0)
+		return 0;
+
+	if (mutex_lock_interruptible(&fifo->mtx))
+		return -EINTR;
 
-	remove_items_cbuffer_t(cbuffer,kbuffer,len);
+	if (filp->f_flags & O_NONBLOCK) {
+		/* Sin bloqueo se devuelve lo que haya, o EAGAIN si no hay nada */
+		if (is_empty_cbuffer_t(cbuffer) && fifo->prod_count>0 && !fifo->removed) {mutex_unlock(&fifo->mtx); return -EAGAIN;}
+	}
+	/* Esperar hasta que haya datos suficientes para consumir (debe haber productores) */
+	else if (wait_with_mutex(fifo,wq_cons,size_cbuffer_t(cbuffer)>=want || fifo->prod_count==0 || fifo->removed))
+		return -EINTR;
 
-	/* Despertar a posible productor bloqueado */
-	if (nr_prod_waiting>0) {
-		/* Despierta a uno de los hilos bloqueados */
-		up(&sem_prod);
-		nr_prod_waiting--;
+	/* Detectar fin de comunicación por error (productor cierra FIFO antes) o borrado del FIFO */
+	if ((fifo->prod_count==0 && is_empty_cbuffer_t(cbuffer)) || fifo->removed) {mutex_unlock(&fifo->mtx); return 0;}
+
+	/* Copiar directamente desde el buffer circular (en dos trozos si da la vuelta).
+	   Puede haber menos de len bytes */
+	len=peek_cbuffer_t(cbuffer,&region,len);
+	if (copy_to_user(buff, region.ptr[0], region.len[0]) ||
+	    copy_to_user(buff+region.len[0], region.ptr[1], region.len[1])) {
+		mutex_unlock(&fifo->mtx);
+		return -EINVAL;
 	}
+	consume_cbuffer_t(cbuffer,len);
+
+	/* Despertar a los productores bloqueados: continúan los que ya tienen hueco */
+	wake_up_interruptible(&fifo->wq_prod);
 
-	up(&mtx); 
-	if (copy_to_user(buff, kbuffer, len)) { return -EINVAL;}
+	mutex_unlock(&fifo->mtx);
 	(*off)+=len;
 	return len;
 }
 
-/* Se invoca al hacer write() de entrada /proc */
+/* Se invoca al hacer write() de entrada /proc.
+   Una escritura que cabe en el buffer se hace de una vez (no se mezcla con
+   otras); una mayor se copia por trozos a medida que los consumidores
+   liberan hueco, y no termina hasta haberlo escrito todo. Sin bloqueo se
+   escribe lo que quepa, de modo que tras un POLLOUT siempre hay progreso */
 static ssize_t fifoproc_write(struct file *filp, const char __user *buff, size_t len, loff_t *off){
-	char kbuffer[MAX_KBUF]="";
+	fifo_t* fifo = (fifo_t*)PDE_DATA(filp->f_inode);
+	cbuffer_t* cbuffer = fifo->cbuffer;
+	cbuffer_region_t region;
+	size_t want=(len<=cbuffer->max_size)?len:1;
+	size_t done=0;
+	ssize_t ret=0;
+	int nr_items;
+
+	if (fifo->record)
+		return fifoproc_write_record(fifo,filp,buff,len);
+
+	if (mutex_lock_interruptible(&fifo->mtx))
+		return -EINTR;
 
-	if (len> MAX_ITEMS_CBUF || len> MAX_KBUF) { return -ENOSPC;}
-	if (copy_from_user(kbuffer,buff,len)) { return -EFAULT;}
-	kbuffer[len] = '\0';
-	*off += len;
+	while (done<len) {
+		if (filp->f_flags & O_NONBLOCK) {
+			/* Sin bloqueo se escribe lo que quepa, o EAGAIN si no cabe nada */
+			if (is_full_cbuffer_t(cbuffer) && fifo->cons_count>0 && !fifo->removed) {ret=-EAGAIN; break;}
+		}
+		/* Esperar hasta que haya hueco para insertar (debe haber consumidores) */
+		else if (wait_with_mutex(fifo,wq_prod,nr_gaps_cbuffer_t(cbuffer)>=want || fifo->cons_count==0 || fifo->removed))
+			/* El mutex ya está libre */
+			return done ? done : -EINTR;
+
+		/* Detectar fin de comunicación por error (consumidor cierra FIFO antes) o borrado del FIFO */
+		if (fifo->cons_count==0 || fifo->removed) {ret=-EPIPE; break;}
+
+		/* Copiar directamente en el buffer circular (en dos trozos si da la vuelta) */
+		nr_items=reserve_cbuffer_t(cbuffer,&region,len-done);
+		if (copy_from_user(region.ptr[0], buff+done, region.len[0]) ||
+		    copy_from_user(region.ptr[1], buff+done+region.len[0], region.len[1])) {
+			ret=-EFAULT;
+			break;
+		}
+		commit_cbuffer_t(cbuffer,nr_items);
+		done+=nr_items;
+		*off += nr_items;
+
+		/* Despertar a los consumidores bloqueados: continúan los que ya tienen datos suficientes */
+		wake_up_interruptible(&fifo->wq_cons);
+	}
+
+	mutex_unlock(&fifo->mtx);
+	return done ? done : ret;
+}
 
-	if (down_interruptible(&mtx))
+/* Copia len bytes de la región, a partir del byte off, a memoria del kernel */
+static void region_to_buf(char* dst, cbuffer_region_t* region, unsigned int off, unsigned int len){
+	unsigned int contig;
+	char* src;
+
+	while (len>0) {
+		src=region_ptr(region,off,&contig);
+		if (contig>len)
+			contig=len;
+		memcpy(dst,src,contig);
+		dst+=contig;
+		off+=contig;
+		len-=contig;
+	}
+}
+
+/* Las páginas que splice_read() entrega a la tubería son propias del módulo */
+static const struct pipe_buf_operations fifo_pipe_buf_ops = {
+	.can_merge = 0,
+	.confirm = generic_pipe_buf_confirm,
+	.release = generic_pipe_buf_release,
+	.steal = generic_pipe_buf_steal,
+	.get = generic_pipe_buf_get,
+};
+
+static void fifo_spd_release(struct splice_pipe_desc *spd, unsigned int i){
+	put_page(spd->pages[i]);
+}
+
+/* Se invoca al hacer splice() de la entrada /proc hacia una tubería.
+   Los datos pasan del buffer circular a páginas nuevas que se enlazan en la
+   tubería, sin atravesar memoria de usuario */
+static ssize_t fifoproc_splice_read(struct file *filp, loff_t *ppos, struct pipe_inode_info *pipe, size_t len, unsigned int flags){
+	fifo_t* fifo = (fifo_t*)PDE_DATA(filp->f_inode);
+	cbuffer_t* cbuffer = fifo->cbuffer;
+	cbuffer_region_t region;
+	struct page *pages[PIPE_DEF_BUFFERS];
+	struct partial_page partial[PIPE_DEF_BUFFERS];
+	struct splice_pipe_desc spd = {
+		.pages = pages,
+		.partial = partial,
+		.nr_pages_max = PIPE_DEF_BUFFERS,
+		.ops = &fifo_pipe_buf_ops,
+		.spd_release = fifo_spd_release,
+	};
+	unsigned int nr_pages,done,chunk;
+	int i;
+
+	/* Partir un mensaje entre páginas de la tubería rompería sus límites */
+	if (fifo->record)
+		return -EINVAL;
+
+	/* Sólo se extrae lo que cabe en los huecos libres de la tubería (do_splice()
+	   ya tiene su cerrojo): lo que se consuma del FIFO no puede perderse */
+	nr_pages=min_t(unsigned int, pipe->buffers - pipe->nrbufs, PIPE_DEF_BUFFERS);
+	if (nr_pages==0 || len==0)
+		return 0;
+
+	if (mutex_lock_interruptible(&fifo->mtx))
 		return -EINTR;
 
-	/* Esperar hasta que haya hueco para insertar (debe haber consumidores) */
-	while (nr_gaps_cbuffer_t(cbuffer)<len && cons_count>0){
-		nr_prod_waiting++;
-		up(&mtx); /* "Libera" el mutex */
-		
-		/* Se bloquea en la cola */
-		if (down_interruptible(&sem_prod)){
-			down(&mtx);
-			nr_prod_waiting--;
-			up(&mtx);
-			
-			return -EINTR;
-		}
-		
-		/* "Adquiere" el mutex */
-		if (down_interruptible(&mtx))
-			return -EINTR;
+	if ((flags & SPLICE_F_NONBLOCK) || (filp->f_flags & O_NONBLOCK)) {
+		if (is_empty_cbuffer_t(cbuffer) && fifo->prod_count>0 && !fifo->removed) {mutex_unlock(&fifo->mtx); return -EAGAIN;}
+	}
+	else if (wait_with_mutex(fifo,wq_cons,!is_empty_cbuffer_t(cbuffer) || fifo->prod_count==0 || fifo->removed))
+		return -EINTR;
+
+	if (is_empty_cbuffer_t(cbuffer) || fifo->removed) {mutex_unlock(&fifo->mtx); return 0;}
+
+	len=min_t(size_t, len, nr_pages*PAGE_SIZE);
+	len=peek_cbuffer_t(cbuffer,&region,len);
+
+	for (done=0; done<len; done+=chunk) {
+		chunk=min_t(unsigned int, len-done, PAGE_SIZE);
+		pages[spd.nr_pages]=alloc_page(GFP_KERNEL);
+		if (!pages[spd.nr_pages])
+			break;
+		region_to_buf(page_address(pages[spd.nr_pages]),&region,done,chunk);
+		partial[spd.nr_pages].offset=0;
+		partial[spd.nr_pages].len=chunk;
+		spd.nr_pages++;
 	}
 
-	/* Detectar fin de comunicación por error (consumidor cierra FIFO antes) */
-	if (cons_count==0) {up(&mtx); return -EPIPE;}
+	if (done==0) {mutex_unlock(&fifo->mtx); return -ENOMEM;}
+
+	consume_cbuffer_t(cbuffer,done);
+	wake_up_interruptible(&fifo->wq_prod);
+	mutex_unlock(&fifo->mtx);
+
+	i=splice_to_pipe(pipe,&spd);
+	if (i>0)
+		*ppos+=i;
+	return i;
+}
 
-	insert_items_cbuffer_t(cbuffer,kbuffer,len);
+/* Vuelca en el FIFO el contenido de un buffer de la tubería (splice_from_pipe()
+   lo invoca por cada uno). Devuelve los bytes insertados, que pueden ser
+   menos que sd->len si no hay hueco para todos */
+static int pipe_to_fifo(struct pipe_inode_info *pipe, struct pipe_buffer *buf, struct splice_desc *sd){
+	struct file *filp = sd->u.file;
+	fifo_t* fifo = (fifo_t*)PDE_DATA(filp->f_inode);
+	cbuffer_t* cbuffer = fifo->cbuffer;
+	cbuffer_region_t region;
+	char* data;
+	int nr_items;
+
+	if (mutex_lock_interruptible(&fifo->mtx))
+		return -EINTR;
 
-	/* Despertar a posible consumidor bloqueado */
-	if (nr_cons_waiting>0) {
-		/* Despierta a uno de los hilos bloqueados */
-		up(&sem_cons);
-		nr_cons_waiting--;
+	if ((sd->flags & SPLICE_F_NONBLOCK) || (filp->f_flags & O_NONBLOCK)) {
+		if (is_full_cbuffer_t(cbuffer) && fifo->cons_count>0 && !fifo->removed) {mutex_unlock(&fifo->mtx); return -EAGAIN;}
 	}
+	else if (wait_with_mutex(fifo,wq_prod,!is_full_cbuffer_t(cbuffer) || fifo->cons_count==0 || fifo->removed))
+		return -EINTR;
+
+	if (fifo->cons_count==0 || fifo->removed) {mutex_unlock(&fifo->mtx); return -EPIPE;}
+
+	/* Copia directa de la página de la tubería al buffer circular */
+	nr_items=reserve_cbuffer_t(cbuffer,&region,sd->len);
+	data=kmap_atomic(buf->page);
+	memcpy(region.ptr[0], data+buf->offset, region.len[0]);
+	memcpy(region.ptr[1], data+buf->offset+region.len[0], region.len[1]);
+	kunmap_atomic(data);
+	commit_cbuffer_t(cbuffer,nr_items);
 
-	up(&mtx); 
+	wake_up_interruptible(&fifo->wq_cons);
+	mutex_unlock(&fifo->mtx);
+	return nr_items;
+}
+
+/* Se invoca al hacer splice() desde una tubería hacia la entrada /proc */
+static ssize_t fifoproc_splice_write(struct pipe_inode_info *pipe, struct file *filp, loff_t *ppos, size_t len, unsigned int flags){
+	fifo_t* fifo = (fifo_t*)PDE_DATA(filp->f_inode);
+
+	if (fifo->record)
+		return -EINVAL;
+
+	return splice_from_pipe(pipe,filp,ppos,len,flags,pipe_to_fifo);
+}
+
+/* Se invoca al hacer poll()/select()/epoll_wait() sobre la entrada /proc */
+static unsigned int fifoproc_poll(struct file *filp, poll_table *wait){
+	fifo_t* fifo = (fifo_t*)PDE_DATA(filp->f_inode);
+	unsigned int mask=0;
+
+	/* Las colas en las que se despierta a quien espera datos o hueco */
+	if (filp->f_mode & FMODE_READ)
+		poll_wait(filp, &fifo->wq_cons, wait);
+	else
+		poll_wait(filp, &fifo->wq_prod, wait);
+
+	mutex_lock(&fifo->mtx);
+
+	if (filp->f_mode & FMODE_READ) {
+		if (!is_empty_cbuffer_t(fifo->cbuffer))
+			mask |= POLLIN | POLLRDNORM;
+		/* Ya no quedan productores: read() devolverá fin de fichero */
+		if (fifo->prod_count==0 || fifo->removed)
+			mask |= POLLHUP;
+	} else {
+		/* Un write() sin bloqueo de un FIFO de bytes escribe lo que quepa. Uno
+		   en modo mensaje es todo o nada: sólo se garantiza que avanza si cabe
+		   la cabecera más el mayor mensaje admitido, es decir, con el buffer vacío */
+		if (fifo->record ? is_empty_cbuffer_t(fifo->cbuffer) : !is_full_cbuffer_t(fifo->cbuffer))
+			mask |= POLLOUT | POLLWRNORM;
+		/* Ya no quedan consumidores: write() devolverá EPIPE */
+		if (fifo->cons_count==0 || fifo->removed)
+			mask |= POLLERR;
+	}
+
+	mutex_unlock(&fifo->mtx);
+	return mask;
+}
+
+/* Se invoca al hacer write() de /proc/modfifo/control:
+   "create <nombre> [stream|record]" crea un FIFO (de bytes por defecto, o
+   de mensajes) y "delete <nombre>" lo borra */
+static ssize_t control_write(struct file *filp, const char __user *buf, size_t len, loff_t *off){
+	char kbuf[BUFFER_LENGTH];
+	char name[FIFO_NAME_LENGTH];
+	char mode[MODE_LENGTH];
+	int ret,n;
+
+	if (len > BUFFER_LENGTH-1)
+		return -ENOSPC;
+
+	if (copy_from_user(kbuf, buf, len))
+		return -EFAULT;
+
+	kbuf[len] = '\0';
+
+	if ((n = sscanf(kbuf, "create %19s %15s", name, mode)) >= 1) {
+		if (n == 1 || strcmp(mode, "stream") == 0)
+			ret = fifo_create(name, 0);
+		else if (strcmp(mode, "record") == 0)
+			ret = fifo_create(name, 1);
+		else
+			ret = -EINVAL;
+	}
+	else if (sscanf(kbuf, "delete %19s", name) == 1)
+		ret = fifo_delete(name);
+	else
+		ret = -EINVAL;
+
+	if (ret < 0)
+		return ret;
+
+	*off += len;
 	return len;
 }
 
@@ -233,23 +768,37 @@ static const struct file_operations proc_entry_fops = {
     .open = fifoproc_open,
     .release = fifoproc_release,
     .read = fifoproc_read,
-    .write = fifoproc_write,    
+    .write = fifoproc_write,
+    .poll = fifoproc_poll,
+    .splice_read = fifoproc_splice_read,
+    .splice_write = fifoproc_splice_write,
+    .unlocked_ioctl = fifoproc_ioctl,
+    .compat_ioctl = fifoproc_ioctl,
+};
+
+static const struct file_operations proc_control_fops = {
+    .write = control_write,
 };
 
 /* Funciones de inicialización y descarga del módulo */
 int init_fifoproc_module(void){
-	cbuffer = create_cbuffer_t(MAX_ITEMS_CBUF);
+	if (fifo_size==0 || fifo_size>MAX_FIFO_SIZE)
+		return -EINVAL;
 
-	if (!cbuffer)
+	proc_dir = proc_mkdir("modfifo", NULL);
+	if (proc_dir == NULL)
 		return -ENOMEM;
 
-	sema_init(&mtx, 1);
-	sema_init(&sem_prod, 0);
-	sema_init(&sem_cons, 0);
+	proc_control_entry = proc_create("control", 0666, proc_dir, &proc_control_fops);
+	if (proc_control_entry == NULL) {
+		remove_proc_entry("modfifo", NULL);
+		return -ENOMEM;
+	}
 
-	proc_entry = proc_create("modfifo",0666, NULL, &proc_entry_fops);
-	if (proc_entry == NULL) {
-		destroy_cbuffer_t(cbuffer);
+	/* FIFO disponible nada más cargar el módulo */
+	if (fifo_create("default",0)) {
+		remove_proc_entry("control", proc_dir);
+		remove_proc_entry("modfifo", NULL);
 		return -ENOMEM;
 	}
 
@@ -0,0 +1,32 @@
+#ifndef FIFOPROC_IOCTL_H
+#define FIFOPROC_IOCTL_H
+
+/* Interfaz binaria de los FIFOs en modo mensaje (/proc/modfifo/<nombre>
+*  creados con "create <nombre> record"), compartida por el módulo y los
+*  programas de usuario */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Cabecera de cada mensaje devuelto por FIFOPROC_IOC_READ_BATCH: le siguen
+*  nr_bytes bytes de datos, y a continuación el siguiente mensaje (sin relleno) */
+struct fifoproc_record {
+    __u32 nr_bytes;
+    char data[];
+};
+
+/* Argumento de FIFOPROC_IOC_READ_BATCH */
+struct fifoproc_ioc_batch {
+    __u64 data;     /* dirección de usuario donde se copian los mensajes */
+    __u32 len;      /* bytes disponibles en 'data' */
+    __u32 nr_msgs;  /* salida: número de mensajes copiados */
+};
+
+#define FIFOPROC_IOC_MAGIC 'f'
+
+/* Extrae tantos mensajes completos como quepan en 'data', cada uno precedido
+*  de su struct fifoproc_record. Se bloquea como read() hasta que haya al
+*  menos uno. Devuelve los bytes copiados (0 en fin de fichero) o EMSGSIZE
+*  si el primer mensaje no cabe */
+#define FIFOPROC_IOC_READ_BATCH _IOWR(FIFOPROC_IOC_MAGIC, 1, struct fifoproc_ioc_batch)
+
+#endif
@@ -0,0 +1 @@
+../../Pr3/FicherosP3/cbuffer.c
\ No newline at end of file
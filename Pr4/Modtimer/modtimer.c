@@ -3,15 +3,29 @@
 #include <linux/proc_fs.h>
 #include <linux/string.h>
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
 #include <asm-generic/uaccess.h>
 #include <asm-generic/errno.h>
 #include <linux/jiffies.h>
 #include <linux/random.h>
 #include "cbuffer.h"
 #include <linux/spinlock.h>
-#include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/poll.h>
 #include <linux/list.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/cpuhotplug.h>
+#include <linux/smp.h>
+#include <linux/workqueue.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
 
 MODULE_LICENSE("GPL");
 
@@ -21,6 +35,10 @@ MODULE_LICENSE("GPL");
 #define DEFAULT_MAX_RANDOM 300
 #define DEFAULT_EMERGENCY_THRESHOLD 80
 #define BUFFER_LENGTH 100
+#define CONFIG_BUFFER_LENGTH 512
+#define READ_CHUNK_LENGTH 256 /* Max bytes returned by a read() of /proc/modtimer */
+#define MAX_CHARS_ITEM 12 /* "4294967295\n" */
+#define DEFAULT_MIN_BATCH 1
 #define MAX_ITEMS_CBUFFER 10 
 
 /* GLOBAL VARIABLES */
@@ -28,19 +46,74 @@ static struct proc_dir_entry *proc_entry; /* modtimer entry */
 static struct proc_dir_entry *proc_config; /* modconfig entry */
 struct timer_list timer; /* Structure that describes the kernel timer */
 static ssize_t timer_period, max_random, emergency_threshold;
+/* High-resolution mode, selected by writing "timer_period_us N" to /proc/modconfig
+*  ("timer_period_ms N" goes back to the jiffies timer). Takes effect on the next open() */
+static struct hrtimer hrtimer;
+static ktime_t hrtimer_period;
+static int use_hrtimer = 0;
+static unsigned long hrtimer_overruns = 0; /* Periods skipped because the callback ran late */
+static atomic_long_t samples_dropped = ATOMIC_LONG_INIT(0); /* Numbers discarded because a ring was full */
 static cbuffer_t* cbuf;  /* Circular buffer */
-struct work_struct copy_items_into_list_ws;
-typedef struct list_item { /* Node of the list */
-    unsigned int data;
+
+/* Flushing runs on a workqueue of our own, so release only waits for our
+*  work. It is unbound unless wq_highpri is set */
+static int wq_highpri = 0;
+module_param(wq_highpri, int, 0444);
+MODULE_PARM_DESC(wq_highpri, "Use a per-CPU WQ_HIGHPRI workqueue instead of a WQ_UNBOUND one");
+static int wq_max_active = 0;
+module_param(wq_max_active, int, 0444);
+MODULE_PARM_DESC(wq_max_active, "Max work items of the workqueue running at once (0: default)");
+static struct workqueue_struct *modtimer_wq;
+
+/* Work item that remembers when it was queued, to measure its latency */
+typedef struct modtimer_work {
+    struct work_struct work;
+    ktime_t enqueued;
+    unsigned long flags; /* MODTIMER_WORK_STAMPED: 'enqueued' belongs to the queued instance */
+} modtimer_work_t;
+#define MODTIMER_WORK_STAMPED 0
+
+/* Workqueue statistics, shown in /proc/modconfig */
+static atomic_t wq_depth = ATOMIC_INIT(0); /* Work items queued and not started yet */
+static DEFINE_SPINLOCK(wq_stats_lock);
+static u64 work_latency_total_ns = 0, work_latency_max_ns = 0;
+static unsigned long nr_works = 0;
+
+modtimer_work_t copy_items_into_list_ws;
+
+/* Per-CPU mode ("percpu 1" in /proc/modconfig, takes effect on the next open()):
+*  every online CPU runs its own pinned hrtimer feeding its own ring. Each ring
+*  has a single producer (the timer of its CPU) and a single consumer (the drain
+*  work), so no lock is needed */
+typedef struct cpu_gen {
+    struct hrtimer hrtimer;
+    cbuffer_t* cbuf;
+    unsigned long overruns;
+} cpu_gen_t;
+static DEFINE_PER_CPU(cpu_gen_t, cpu_gens);
+static int use_percpu = 0;
+static int percpu_running = 0; /* Generators started (protected by the CPU hotplug lock) */
+static ktime_t percpu_period;
+static enum cpuhp_state cpuhp_online; /* Dynamic hotplug state of the generators */
+modtimer_work_t drain_percpu_ws; /* Merges the per-CPU rings into the list */
+typedef struct list_item { /* Node of the list: a batch of numbers moved together from a ring */
+    unsigned int nr_items;
+    unsigned int first; /* First number not read yet */
     struct list_head links;
+    unsigned int data[];
 } list_item_t;
 struct list_head mylist; /* head of the linked list. all the nodes are in dynamic memory. */
 
 /* SYNCHRONIZATION VARIABLES */
-DEFINE_SPINLOCK(cbuff_sp);
-struct semaphore list_mtx;
-struct semaphore sem_list; /* user queue consumer */
-int waiting=0;
+/* cbuf needs no lock: the timer is its only producer and the work its only consumer (SPSC) */
+static DEFINE_MUTEX(list_mtx);
+static DECLARE_WAIT_QUEUE_HEAD(list_wq); /* user queue consumer */
+static unsigned int nr_list_items = 0; /* Numbers in the list not read yet */
+/* The reader sleeps until min_batch numbers are available, and then keeps
+*  reading (in chunks of READ_CHUNK_LENGTH bytes) until the list is empty */
+static unsigned int min_batch = DEFAULT_MIN_BATCH;
+static int list_draining = 0;
+static atomic_t reader_busy = ATOMIC_INIT(0); /* /proc/modtimer is open */
 
 
 /* PROTOTYPES */
@@ -51,19 +124,30 @@ static int modtimer_open(struct inode *inode, struct file *file);
 /* Invoked when calling close() at /proc entry */
 static int modtimer_release(struct inode *inode, struct file *file);
 static ssize_t modtimer_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
+static unsigned int modtimer_poll(struct file *filp, poll_table *wait);
 /* Function invoked when timer expires (fires) */
 static void fire_timer(unsigned long data);
+/* Same for the high-resolution timer */
+static enum hrtimer_restart fire_hrtimer(struct hrtimer *timer);
+static enum hrtimer_restart fire_cpu_hrtimer(struct hrtimer *timer);
 /* Work's handler function, invoked to move the data in the buffer to a list */
 static void copy_items_into_list_func(struct work_struct *work);
+/* Same for the per-CPU rings */
+static void drain_percpu_func(struct work_struct *work);
+/* CPU hotplug callbacks: start/stop the generator of a CPU in per-CPU mode */
+static int modtimer_cpu_online(unsigned int cpu);
+static int modtimer_cpu_offline(unsigned int cpu);
 /* Linked list auxiliary functions */
-static int my_list_add(unsigned int aux_buffer[], int count);
-static int list_cleanup(void);
+static void drain_ring(cbuffer_t* ring);
+static void my_list_add(list_item_t* batch);
+static void list_cleanup(void);
 
 /* FILE OPS FOR PROC ENTRIES */
 static const struct file_operations proc_entry_fops = {
     .open = modtimer_open,
     .release = modtimer_release,
-    .read = modtimer_read,   
+    .read = modtimer_read,
+    .poll = modtimer_poll,
 };
 
 static const struct file_operations proc_conf_entry_fops = {
@@ -72,41 +156,58 @@ static const struct file_operations proc_conf_entry_fops = {
 };
 
 /* FUNCTIONS */
-int init_modtimer( void ) {
+static void destroy_percpu_rings(void) {
+    int cpu;
 
-    /* PROC ENTRIES SETUP */
-    proc_entry = proc_create("modtimer", 0666, NULL, &proc_entry_fops);
-    if (proc_entry == NULL) {
-        printk(KERN_INFO "modtimer: Can't create /proc entry\n");
-        return -ENOMEM;
+    for_each_possible_cpu(cpu) {
+        if (per_cpu(cpu_gens, cpu).cbuf)
+            destroy_cbuffer_t(per_cpu(cpu_gens, cpu).cbuf);
+        per_cpu(cpu_gens, cpu).cbuf = NULL;
     }
+}
 
-    proc_config = proc_create("modconfig", 0666, NULL, &proc_conf_entry_fops);
-    if (proc_entry == NULL) {
-        printk(KERN_INFO "modtimer: Can't create /proc conf entry\n");
-        return -ENOMEM;
-    }
+int init_modtimer( void ) {
+    int cpu, ret;
 
     /* CIRCULAR BUFFER SETUP */
-    cbuf = create_cbuffer_t(MAX_ITEMS_CBUFFER);
+    cbuf = create_cbuffer_t(MAX_ITEMS_CBUFFER, sizeof(unsigned int));
 
     if (!cbuf) {
         return -ENOMEM;
     }
 
-    /* CBUFFER WORK STRUCTURE SETUP */
-    INIT_WORK(&copy_items_into_list_ws, copy_items_into_list_func);
+    /* WORKQUEUE SETUP */
+    modtimer_wq = alloc_workqueue("modtimer", wq_highpri ? WQ_HIGHPRI : WQ_UNBOUND, wq_max_active);
+    if (!modtimer_wq) {
+        ret = -ENOMEM;
+        goto out_cbuf;
+    }
 
-    /* LINKED LIST SETUP */
-    INIT_LIST_HEAD( &mylist );
+    /* PER-CPU GENERATORS SETUP */
+    for_each_possible_cpu(cpu) {
+        cpu_gen_t* gen = &per_cpu(cpu_gens, cpu);
 
-    if (!list_empty(&mylist))
-        return -ENOMEM;
+        gen->cbuf = create_cbuffer_t(MAX_ITEMS_CBUFFER, sizeof(unsigned int));
+        if (!gen->cbuf) {
+            ret = -ENOMEM;
+            goto out_rings;
+        }
+        hrtimer_init(&gen->hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+        gen->hrtimer.function = fire_cpu_hrtimer;
+    }
+
+    ret = cpuhp_setup_state_nocalls(CPUHP_AP_ONLINE_DYN, "modtimer:online",
+                                    modtimer_cpu_online, modtimer_cpu_offline);
+    if (ret < 0)
+        goto out_rings;
+    cpuhp_online = ret;
 
-    /* USER WAITING QUEUE SETUP */
-    sema_init(&sem_list, 0);
+    /* CBUFFER WORK STRUCTURE SETUP */
+    INIT_WORK(&copy_items_into_list_ws.work, copy_items_into_list_func);
+    INIT_WORK(&drain_percpu_ws.work, drain_percpu_func);
 
-    sema_init(&list_mtx, 1);
+    /* LINKED LIST SETUP */
+    INIT_LIST_HEAD( &mylist );
 
     /* TIMER SETUP */
     timer_period = DEFAULT_TIMER_PERIOD;
@@ -120,14 +221,47 @@ int init_modtimer( void ) {
     timer.function=fire_timer;
     timer.expires=0;
 
+    hrtimer_init(&hrtimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    hrtimer.function = fire_hrtimer;
+    hrtimer_period = ms_to_ktime(jiffies_to_msecs(timer_period));
+
+    /* PROC ENTRIES SETUP, last: they can be opened as soon as they exist */
+    proc_entry = proc_create("modtimer", 0666, NULL, &proc_entry_fops);
+    if (proc_entry == NULL) {
+        printk(KERN_INFO "modtimer: Can't create /proc entry\n");
+        ret = -ENOMEM;
+        goto out_cpuhp;
+    }
+
+    proc_config = proc_create("modconfig", 0666, NULL, &proc_conf_entry_fops);
+    if (proc_config == NULL) {
+        printk(KERN_INFO "modtimer: Can't create /proc conf entry\n");
+        ret = -ENOMEM;
+        goto out_proc;
+    }
+
     printk(KERN_INFO "modtimer: Module loaded.\n");
 
     return 0;
+
+out_proc:
+    remove_proc_entry("modtimer", NULL);
+out_cpuhp:
+    cpuhp_remove_state_nocalls(cpuhp_online);
+out_rings:
+    destroy_percpu_rings();
+    destroy_workqueue(modtimer_wq);
+out_cbuf:
+    destroy_cbuffer_t(cbuf);
+    return ret;
 }
 
 
 void exit_modtimer( void ) {
 
+    cpuhp_remove_state_nocalls(cpuhp_online);
+    destroy_workqueue(modtimer_wq);
+    destroy_percpu_rings();
     destroy_cbuffer_t(cbuf);
     remove_proc_entry("modtimer", NULL);
     remove_proc_entry("modconfig", NULL);
@@ -135,64 +269,239 @@ void exit_modtimer( void ) {
     printk(KERN_INFO "modtimer: Module unloaded.\n");
 }
 
-static void fire_timer(unsigned long data) {
-    unsigned long flags = 0;
-
+/* Generates one sample into 'ring'. Returns 1 once the ring reaches the emergency threshold */
+static int generate_sample(cbuffer_t* ring) {
     unsigned int rand_number = get_random_int() % (max_random - 1);
-    printk(KERN_INFO "Generated number: %u\n", rand_number);
 
-    spin_lock_irqsave(&cbuff_sp, flags);
-    insert_cbuffer_t(cbuf, rand_number);
-    spin_unlock_irqrestore(&cbuff_sp, flags);
+    /* At sub-millisecond rates one message per sample would flood the log */
+    if (!use_hrtimer)
+        printk(KERN_INFO "Generated number: %u\n", rand_number);
+
+    /* The work hasn't emptied the buffer yet: drop the number. Only counted
+    *  (see /proc/modconfig), this may happen at every sample */
+    if (!spsc_insert_cbuffer_t(ring, &rand_number))
+        atomic_long_inc(&samples_dropped);
+
+    /* The ring holds max_size numbers (MAX_ITEMS_CBUFFER rounded up to a power of two) */
+    return size_cbuffer_t(ring) >= (emergency_threshold*ring->max_size)/100;
+}
+
+/* Queues 'mw' on modtimer_wq (on 'cpu' if the queue is bound) unless it is already pending */
+static void modtimer_queue_work(int cpu, modtimer_work_t* mw) {
+    /* Several timers may get here at once: only the one that sets the bit
+    *  stamps and queues, so 'enqueued' is never overwritten while queued */
+    if (test_and_set_bit(MODTIMER_WORK_STAMPED, &mw->flags))
+        return;
+
+    mw->enqueued = ktime_get();
+    if (queue_work_on(cpu, modtimer_wq, &mw->work))
+        atomic_inc(&wq_depth);
+    else
+        clear_bit_unlock(MODTIMER_WORK_STAMPED, &mw->flags);
+}
+
+/* Called first thing by every work handler: accounts its queueing latency */
+static void modtimer_work_started(struct work_struct *work) {
+    modtimer_work_t* mw = container_of(work, modtimer_work_t, work);
+    u64 latency = ktime_to_ns(ktime_sub(ktime_get(), mw->enqueued));
+
+    /* The stamp has been read: the work may be queued (and stamped) again */
+    clear_bit_unlock(MODTIMER_WORK_STAMPED, &mw->flags);
+    atomic_dec(&wq_depth);
+
+    spin_lock(&wq_stats_lock);
+    work_latency_total_ns += latency;
+    if (latency > work_latency_max_ns)
+        work_latency_max_ns = latency;
+    nr_works++;
+    spin_unlock(&wq_stats_lock);
+}
 
-    if (!work_pending(&copy_items_into_list_ws) && size_cbuffer_t(cbuf)==((emergency_threshold*MAX_ITEMS_CBUFFER)/100)){
-        schedule_work_on(!smp_processor_id(), &copy_items_into_list_ws); // just 2 cpus, 0 or 1. get the other one and queue work
-        printk("%i elements moved from the buffer to the list\n", size_cbuffer_t(cbuf));
+/* Global generator: a single timer feeding cbuf */
+static void generate_global_sample(void) {
+    int cpu;
+
+    if (generate_sample(cbuf) && !work_pending(&copy_items_into_list_ws.work)) {
+        /* Flush from another online CPU, if there is one */
+        cpu = cpumask_any_but(cpu_online_mask, smp_processor_id());
+        if (cpu >= nr_cpu_ids)
+            cpu = smp_processor_id();
+        modtimer_queue_work(cpu, &copy_items_into_list_ws);
+        /* Not at hrtimer rates: see generate_sample() */
+        if (!use_hrtimer)
+            printk("%i elements moved from the buffer to the list\n", size_cbuffer_t(cbuf));
     }
+}
+
+static void fire_timer(unsigned long data) {
+    generate_global_sample();
 
     /* Re-activate the timer 'timer_period' from now */
     mod_timer(&(timer), jiffies + timer_period);
 }
 
-static void copy_items_into_list_func(struct work_struct *work) {
-    int count = 0;
-    unsigned long flags = 0;
-    unsigned int aux_buffer[MAX_ITEMS_CBUFFER];
-
-    while(!is_empty_cbuffer_t(cbuf)) {
-        spin_lock_irqsave(&cbuff_sp, flags);
-        aux_buffer[count] = head_cbuffer_t(cbuf);
-        remove_cbuffer_t(cbuf);
-        spin_unlock_irqrestore(&cbuff_sp, flags);
-        count++;
+static enum hrtimer_restart fire_hrtimer(struct hrtimer *timer) {
+    u64 overruns;
+
+    generate_global_sample();
+
+    /* Re-arm on the next multiple of the period since the first expiry, so the
+    *  rate doesn't drift with the callback latency. Whole periods that already
+    *  went by are skipped and counted */
+    overruns = hrtimer_forward_now(timer, hrtimer_period);
+    if (overruns > 1)
+        hrtimer_overruns += overruns - 1;
+
+    return HRTIMER_RESTART;
+}
+
+/* Generator of one CPU in per-CPU mode. Runs pinned on that CPU */
+static enum hrtimer_restart fire_cpu_hrtimer(struct hrtimer *timer) {
+    cpu_gen_t* gen = container_of(timer, cpu_gen_t, hrtimer);
+    u64 overruns;
+
+    if (generate_sample(gen->cbuf))
+        modtimer_queue_work(WORK_CPU_UNBOUND, &drain_percpu_ws);
+
+    overruns = hrtimer_forward_now(timer, percpu_period);
+    if (overruns > 1)
+        gen->overruns += overruns - 1;
+
+    return HRTIMER_RESTART;
+}
+
+/* Starts the generator of the calling CPU (on_each_cpu() or hotplug callback) */
+static void start_cpu_generator(void *unused) {
+    hrtimer_start(&this_cpu_ptr(&cpu_gens)->hrtimer, percpu_period, HRTIMER_MODE_REL_PINNED);
+}
+
+/* Invoked on the CPU that comes online */
+static int modtimer_cpu_online(unsigned int cpu) {
+    if (percpu_running)
+        start_cpu_generator(NULL);
+    return 0;
+}
+
+/* Invoked on the CPU that goes offline, before it stops running tasks. Its
+*  ring is left for the drain work, which walks every possible CPU */
+static int modtimer_cpu_offline(unsigned int cpu) {
+    hrtimer_cancel(&per_cpu(cpu_gens, cpu).hrtimer);
+    if (!is_empty_cbuffer_t(per_cpu(cpu_gens, cpu).cbuf))
+        modtimer_queue_work(WORK_CPU_UNBOUND, &drain_percpu_ws);
+    return 0;
+}
+
+static void start_percpu_generators(void) {
+    int cpu;
+
+    percpu_period = use_hrtimer ? hrtimer_period : ms_to_ktime(jiffies_to_msecs(timer_period));
+    for_each_possible_cpu(cpu)
+        per_cpu(cpu_gens, cpu).overruns = 0;
+
+    get_online_cpus();
+    percpu_running = 1;
+    on_each_cpu(start_cpu_generator, NULL, 1);
+    put_online_cpus();
+}
+
+static void stop_percpu_generators(void) {
+    int cpu;
+
+    get_online_cpus();
+    percpu_running = 0;
+    for_each_online_cpu(cpu)
+        hrtimer_cancel(&per_cpu(cpu_gens, cpu).hrtimer);
+    put_online_cpus();
+}
+
+/* Moves everything in 'ring' to the list as a single node: one allocation
+*  and one acquisition of list_mtx per batch instead of per number */
+static void drain_ring(cbuffer_t* ring) {
+    list_item_t* batch;
+    int count = size_cbuffer_t(ring);
+
+    if (count == 0)
+        return;
+
+    batch = kmalloc(sizeof(list_item_t) + count * sizeof(unsigned int), GFP_KERNEL);
+    if (!batch) {
+        printk(KERN_INFO "modtimer: can't allocate a batch of %d numbers\n", count);
+        return;
     }
 
-    my_list_add(aux_buffer, count);
+    /* The producer may add more meanwhile: they are left for the next drain */
+    batch->nr_items = spsc_remove_items_cbuffer_t(ring, batch->data, count);
+    my_list_add(batch);
+}
+
+static void drain_percpu_func(struct work_struct *work) {
+    int cpu;
+
+    modtimer_work_started(work);
+
+    for_each_possible_cpu(cpu)
+        drain_ring(per_cpu(cpu_gens, cpu).cbuf);
+}
+
+static void copy_items_into_list_func(struct work_struct *work) {
+    modtimer_work_started(work);
+    drain_ring(cbuf);
 }
 
 static ssize_t modtimer_config_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-    char* configbuffer = (char *)vmalloc( BUFFER_LENGTH );
-    ssize_t buf_length = 0;
+    char* configbuffer;
+    ssize_t buf_length = 0, ret;
+    unsigned long overruns = hrtimer_overruns;
+    u64 latency_avg_ns, latency_max_ns;
+    int cpu;
 
     if ((*off) > 0) /* Tell the application that there is nothing left to read */
         return 0;
-    
-    if (len<1)
-        return -ENOSPC;
+
+    configbuffer = (char *)vmalloc( CONFIG_BUFFER_LENGTH );
+    if (!configbuffer)
+        return -ENOMEM;
 
     /* Print current configuration to the buffer */
     buf_length += sprintf(configbuffer + buf_length, "timer_period_ms=%u\n", jiffies_to_msecs(timer_period));
+    buf_length += sprintf(configbuffer + buf_length, "timer_period_us=%lld\n", ktime_to_us(hrtimer_period));
+    buf_length += sprintf(configbuffer + buf_length, "timer=%s\n", use_hrtimer ? "hrtimer" : "jiffies");
+    for_each_possible_cpu(cpu)
+        overruns += per_cpu(cpu_gens, cpu).overruns;
+    buf_length += sprintf(configbuffer + buf_length, "hrtimer_overruns=%lu\n", overruns);
+    buf_length += sprintf(configbuffer + buf_length, "samples_dropped=%ld\n", atomic_long_read(&samples_dropped));
+    buf_length += sprintf(configbuffer + buf_length, "percpu=%d\n", use_percpu);
+
+    spin_lock(&wq_stats_lock);
+    latency_avg_ns = nr_works ? div64_u64(work_latency_total_ns, nr_works) : 0;
+    latency_max_ns = work_latency_max_ns;
+    spin_unlock(&wq_stats_lock);
+    buf_length += sprintf(configbuffer + buf_length, "workqueue=%s max_active=%d\n",
+                          wq_highpri ? "highpri" : "unbound", wq_max_active);
+    buf_length += sprintf(configbuffer + buf_length, "wq_depth=%d\n", atomic_read(&wq_depth));
+    buf_length += sprintf(configbuffer + buf_length, "work_latency_avg_us=%llu\n", div_u64(latency_avg_ns, NSEC_PER_USEC));
+    buf_length += sprintf(configbuffer + buf_length, "work_latency_max_us=%llu\n", div_u64(latency_max_ns, NSEC_PER_USEC));
     buf_length += sprintf(configbuffer + buf_length, "emergency_threshold=%zu\n", emergency_threshold);
     buf_length += sprintf(configbuffer + buf_length, "max_random=%zu\n", max_random);
+    buf_length += sprintf(configbuffer + buf_length, "min_batch=%u\n", min_batch);
+
+    /* The whole configuration must fit in the user buffer */
+    if (len < buf_length) {
+        ret = -ENOSPC;
+        goto out;
+    }
 
     /* Transfer data from the kernel to userspace  */
-    if (copy_to_user(buf, configbuffer, buf_length))
-        return -EINVAL;
+    if (copy_to_user(buf, configbuffer, buf_length)) {
+        ret = -EFAULT;
+        goto out;
+    }
 
-    (*off)+=len;  /* Update the file pointer */
+    (*off)+=buf_length;  /* Update the file pointer */
+    ret = buf_length;
+out:
     vfree(configbuffer);
-
-    return buf_length;
+    return ret;
 }
 
 static ssize_t modtimer_config_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
@@ -216,13 +525,33 @@ static ssize_t modtimer_config_write(struct file *filp, const char __user *buf,
 
     if(sscanf(configbuffer, "timer_period_ms %zu", &num) == 1) {
         timer_period = msecs_to_jiffies(num);
+        use_hrtimer = 0;
+    }
+    else if(sscanf(configbuffer, "timer_period_us %zu", &num) == 1) {
+        if (num == 0)
+            return -EINVAL;
+        hrtimer_period = us_to_ktime(num);
+        use_hrtimer = 1;
     }
     else if(sscanf(configbuffer, "emergency_threshold %zu", &num) == 1) {
+        /* Percentage of the ring: above 100 the work would never be queued */
+        if (num > 100)
+            return -EINVAL;
         emergency_threshold = num;
     }
     else if(sscanf(configbuffer, "max_random %zu", &num) == 1) {
         max_random = num;
     }
+    else if(sscanf(configbuffer, "min_batch %zu", &num) == 1) {
+        if (num == 0 || num > UINT_MAX)
+            return -EINVAL;
+        min_batch = num;
+        /* A lower threshold may already be met */
+        wake_up_interruptible(&list_wq);
+    }
+    else if(sscanf(configbuffer, "percpu %zu", &num) == 1) {
+        use_percpu = (num != 0);
+    }
 
     *off+=len; /* Update the file pointer */
 
@@ -231,13 +560,25 @@ static ssize_t modtimer_config_write(struct file *filp, const char __user *buf,
 
 static int modtimer_open(struct inode *inode, struct file *file) {
 
-    if (waiting != 0) // to avoid segfault
-        return 1;
+    /* A single reader: the timers can't be started twice */
+    if (atomic_cmpxchg(&reader_busy, 0, 1) != 0)
+        return -EBUSY;
+
+    atomic_long_set(&samples_dropped, 0);
 
-    /* Activate it X seconds from now */
-    timer.expires=jiffies + timer_period;
-    /* Activate the timer */
-    add_timer(&timer);
+    if (use_percpu) {
+        start_percpu_generators();
+    }
+    else if (use_hrtimer) {
+        hrtimer_overruns = 0;
+        hrtimer_start(&hrtimer, hrtimer_period, HRTIMER_MODE_REL);
+    }
+    else {
+        /* Activate it X seconds from now */
+        timer.expires=jiffies + timer_period;
+        /* Activate the timer */
+        add_timer(&timer);
+    }
 
     try_module_get(THIS_MODULE);
 
@@ -245,105 +586,145 @@ static int modtimer_open(struct inode *inode, struct file *file) {
 }
 
 static int modtimer_release(struct inode *inode, struct file *file) {
+    int cpu;
+
     /* Wait until completion of the timer function (if it's currently running) and delete timer */
     del_timer_sync(&timer);
+    hrtimer_cancel(&hrtimer);
+    stop_percpu_generators();
 
-    /* Wait until all jobs scheduled so far have finished */
-    flush_scheduled_work();
+    /* Wait until all our jobs scheduled so far have finished */
+    flush_workqueue(modtimer_wq);
 
     clear_cbuffer_t(cbuf);
+    for_each_possible_cpu(cpu)
+        clear_cbuffer_t(per_cpu(cpu_gens, cpu).cbuf);
     list_cleanup();
 
     module_put(THIS_MODULE);
+    atomic_set(&reader_busy, 0);
 
     return 0;
 }
 
+/* Whether the reader may take numbers from the list. Called with list_mtx held
+*  or, as a hint, without it */
+static int list_readable(void) {
+    return nr_list_items > 0 && (list_draining || nr_list_items >= min_batch);
+}
+
 static ssize_t modtimer_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
     struct list_item* item = NULL;
-    struct list_head* node=NULL;
-    struct list_head* aux=NULL;
-    char modlistbuffer[BUFFER_LENGTH];
+    char modlistbuffer[READ_CHUNK_LENGTH];
+    char number[MAX_CHARS_ITEM+1];
     ssize_t buf_length = 0;
+    int chars;
 
     if (len<1)
         return -ENOSPC;
 
-    if (down_interruptible(&list_mtx))
+    if (len > READ_CHUNK_LENGTH)
+        len = READ_CHUNK_LENGTH;
+
+    if (mutex_lock_interruptible(&list_mtx))
         return -EINTR;
 
-    while(list_empty(&mylist)){
-        waiting++;
-        up(&list_mtx);  
-        if(down_interruptible(&sem_list)){
-            down(&list_mtx);
-            waiting--;
-            up(&list_mtx);  
-            return -EINTR;    
-        }
-        if (down_interruptible(&list_mtx))
+    /* Sleep until there are min_batch numbers (or the rest of a batch already started) */
+    while (!list_readable()) {
+        mutex_unlock(&list_mtx);
+
+        if (filp->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if (wait_event_interruptible(list_wq, list_readable()))
             return -EINTR;
-    }   
+        if (mutex_lock_interruptible(&list_mtx))
+            return -EINTR;
+    }
+
+    list_draining = 1;
+
+    /* Copy as many whole numbers as fit in 'len'; the rest are left for the next read */
+    while (!list_empty(&mylist)) {
+        item = list_first_entry(&mylist, struct list_item, links);
+        chars = sprintf(number, "%u\n", item->data[item->first]);
+        if (buf_length + chars > len)
+            break;
 
-    list_for_each_safe(node, aux, &mylist) {
-        item = list_entry(node, struct list_item, links);
-        buf_length += sprintf(modlistbuffer + buf_length, "%u\n", item->data);
-        list_del(node);
-        vfree(item);
+        memcpy(modlistbuffer + buf_length, number, chars);
+        buf_length += chars;
+        nr_list_items--;
+
+        if (++item->first == item->nr_items) {
+            list_del(&item->links);
+            kfree(item);
+        }
     }
 
-    up(&list_mtx);    
+    if (list_empty(&mylist))
+        list_draining = 0;
+
+    mutex_unlock(&list_mtx);
+
+    /* Not even one number fits */
+    if (buf_length == 0)
+        return -ENOSPC;
 
     /* Transfer data from the kernel to userspace  */
     if (copy_to_user(buf, modlistbuffer, buf_length))
-    return -EINVAL;
+        return -EINVAL;
 
-    (*off)+=len;  /* Update the file pointer */
+    (*off)+=buf_length;  /* Update the file pointer */
 
     return buf_length;
 }
 
-static int my_list_add(unsigned int aux_buffer[], int count){
+static unsigned int modtimer_poll(struct file *filp, poll_table *wait) {
+    unsigned int mask = 0;
 
-    int i;
+    poll_wait(filp, &list_wq, wait);
 
-    if (down_interruptible(&list_mtx))
-        return -EINTR;
+    mutex_lock(&list_mtx);
+    if (list_readable())
+        mask |= POLLIN | POLLRDNORM;
+    mutex_unlock(&list_mtx);
 
-    for(i = 0; i < count; i++){
-        struct list_item* nodo = vmalloc(sizeof(struct list_item));
-        nodo->data = aux_buffer[i];
-        list_add_tail(&nodo->links,&mylist);
-    }
+    return mask;
+}
 
-    if(!list_empty(&mylist) && waiting > 0){
-        up(&sem_list);
-        waiting--;
-    }
+static void my_list_add(list_item_t* batch){
 
-    up(&list_mtx); 
+    batch->first = 0;
 
-    return 0;
+    mutex_lock(&list_mtx);
+
+    list_add_tail(&batch->links,&mylist);
+    nr_list_items += batch->nr_items;
+
+    /* Wake the reader only once the batch threshold is reached */
+    if (list_readable())
+        wake_up_interruptible(&list_wq);
+
+    mutex_unlock(&list_mtx);
 }
 
-static int list_cleanup(void) {
+static void list_cleanup(void) {
     struct list_item* item=NULL;
     struct list_head* cur_node=NULL;
     struct list_head* aux=NULL;
 
-    if (down_interruptible(&list_mtx))
-        return -EINTR;
+    mutex_lock(&list_mtx);
 
     list_for_each_safe(cur_node, aux, &mylist){
         item = list_entry(cur_node, struct list_item, links);
 
         list_del(cur_node);
-        vfree(item);
+        kfree(item);
     }
 
-    up(&list_mtx);
+    nr_list_items = 0;
+    list_draining = 0;
 
-    return 0;
+    mutex_unlock(&list_mtx);
 }
 
 module_init( init_modtimer );
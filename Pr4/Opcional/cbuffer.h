@@ -0,0 +1 @@
+../../Pr3/FicherosP3/cbuffer.h
\ No newline at end of file
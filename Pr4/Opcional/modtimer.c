@@ -95,8 +95,8 @@ int init_modtimer( void ) {
     }
 
     /* CIRCULAR BUFFER SETUP */
-    cbuf_pair = create_cbuffer_t(MAX_ITEMS_CBUFFER);
-    cbuff_odd = create_cbuffer_t(MAX_ITEMS_CBUFFER);
+    cbuf_pair = create_cbuffer_t(MAX_ITEMS_CBUFFER, sizeof(unsigned int));
+    cbuf_odd = create_cbuffer_t(MAX_ITEMS_CBUFFER, sizeof(unsigned int));
 
     if (!cbuf) {
         return -ENOMEM;
@@ -156,7 +156,7 @@ static void fire_timer(unsigned long data) {
 
     if(rand_number % 2) { // odd number
         spin_lock_irqsave(&cbuff_odd_sp, flags);
-        insert_cbuffer_t(cbuf_odd, rand_number);
+        insert_cbuffer_t(cbuf_odd, &rand_number);
         spin_unlock_irqrestore(&cbuff_odd_sp, flags);
 
         if (!work_pending(&copy_items_into_list_odd_ws) && size_cbuffer_t(cbuf_odd)==((emergency_threshold*MAX_ITEMS_CBUFFER)/100)){
@@ -166,7 +166,7 @@ static void fire_timer(unsigned long data) {
     }
     else { // pair number
         spin_lock_irqsave(&cbuff_pair_sp, flags);
-        insert_cbuffer_t(cbuf_pair, rand_number);
+        insert_cbuffer_t(cbuf_pair, &rand_number);
         spin_unlock_irqrestore(&cbuff_pair_sp, flags);
 
         if (!work_pending(&copy_items_into_list_pair_ws) && size_cbuffer_t(cbuf_pair)==((emergency_threshold*MAX_ITEMS_CBUFFER)/100)){
@@ -186,8 +186,7 @@ static void copy_items_into_list_pair_func(struct work_struct *work) {
 
     while(!is_empty_cbuffer_t(cbuf_pair)) {
         spin_lock_irqsave(&cbuff_pair_sp, flags);
-        aux_buffer[count] = head_cbuffer_t(cbuf_pair);
-        remove_cbuffer_t(cbuf_pair);
+        remove_cbuffer_t(cbuf_pair, &aux_buffer[count]);
         spin_unlock_irqrestore(&cbuff_pair_sp, flags);
         count++;
     }
@@ -202,8 +201,7 @@ static void copy_items_into_list_odd_func(struct work_struct *work) {
 
     while(!is_empty_cbuffer_t(cbuf_odd)) {
         spin_lock_irqsave(&cbuff_odd_sp, flags);
-        aux_buffer[count] = head_cbuffer_t(cbuf_odd);
-        remove_cbuffer_t(cbuf_odd);
+        remove_cbuffer_t(cbuf_odd, &aux_buffer[count]);
         spin_unlock_irqrestore(&cbuff_odd_sp, flags);
         count++;
     }
@@ -0,0 +1,340 @@
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <err.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include "modlist_ioctl.h"
+
+#define PROC_DIR "/proc/multilist"
+#define DEFAULT_NR_ITEMS 100000
+#define DEFAULT_NR_REMOVES 100
+#define READ_CHUNK (64*1024)
+
+char* nombre_programa=NULL;
+
+static double now (void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report (const char* test, long nr_items, size_t bytes, double secs) {
+  printf("%-14s %10ld items %9.3f s %12.0f items/s %9.2f MB/s\n",
+	 test, nr_items, secs, nr_items / secs, bytes / secs / (1024*1024));
+}
+
+/* Writes a whole string to a /proc entry */
+static int write_str (const char* path, const char* str) {
+  int fd=open(path,O_WRONLY);
+  int ret=0;
+
+  if (fd<0)
+	err(1,"%s",path);
+  if (write(fd,str,strlen(str))<0)
+	ret=-errno;
+  close(fd);
+  return ret;
+}
+
+/* Text interface: one "add N" command per line, all in one write() */
+static void text_import (const char* path, int32_t* items, long nr_items) {
+  char* cmds=malloc(nr_items*20+1);
+  size_t len=0;
+  ssize_t wbytes;
+  double start;
+  int fd;
+  long i;
+
+  if (!cmds)
+	err(1,"malloc");
+  for (i=0;i<nr_items;i++)
+	len+=sprintf(cmds+len,"add %d\n",items[i]);
+
+  if ((fd=open(path,O_WRONLY))<0)
+	err(1,"%s",path);
+
+  start=now();
+  for (i=0;i<len;i+=wbytes) {
+	if ((wbytes=write(fd,cmds+i,len-i))<=0)
+		err(1,"write %s",path);
+  }
+  report("text write",nr_items,len,now()-start);
+
+  close(fd);
+  free(cmds);
+}
+
+/* Text interface: read() the entry and parse one number per line */
+static long text_export (const char* path, int64_t* sum) {
+  char* buf=malloc(READ_CHUNK+1);
+  char* line;
+  char* nl;
+  size_t pending=0, total=0;
+  ssize_t rbytes;
+  long nr_items=0;
+  double start;
+  int fd;
+
+  if (!buf)
+	err(1,"malloc");
+  if ((fd=open(path,O_RDONLY))<0)
+	err(1,"%s",path);
+
+  *sum=0;
+  start=now();
+  while ((rbytes=read(fd,buf+pending,READ_CHUNK-pending))>0) {
+	total+=rbytes;
+	pending+=rbytes;
+	buf[pending]='\0';
+	line=buf;
+	while ((nl=strchr(line,'\n'))!=NULL) {
+		*sum+=strtol(line,NULL,10);
+		nr_items++;
+		line=nl+1;
+	}
+	/* Keep the incomplete last line for the next read */
+	pending-=line-buf;
+	memmove(buf,line,pending);
+  }
+  if (rbytes<0)
+	err(1,"read %s",path);
+  report("text read",nr_items,total,now()-start);
+
+  close(fd);
+  free(buf);
+  return nr_items;
+}
+
+/* Binary interface: MODLIST_IOC_IMPORT in batches of MODLIST_IOC_MAX_ITEMS */
+static void binary_import (const char* path, int32_t* items, long nr_items) {
+  struct modlist_ioc_buf ioc;
+  double start;
+  long i, ret;
+  int fd;
+
+  if ((fd=open(path,O_RDONLY))<0)
+	err(1,"%s",path);
+
+  start=now();
+  for (i=0;i<nr_items;i+=ret) {
+	ioc.data=(uintptr_t)(items+i);
+	ioc.nr_items=nr_items-i;
+	ioc.offset=0;
+	if ((ret=ioctl(fd,MODLIST_IOC_IMPORT,&ioc))<=0)
+		err(1,"ioctl import %s",path);
+  }
+  report("binary write",nr_items,nr_items*sizeof(int32_t),now()-start);
+
+  close(fd);
+}
+
+/* Binary interface: MODLIST_IOC_EXPORT until it returns 0 */
+static long binary_export (const char* path, long max_items, int64_t* sum) {
+  int32_t* items=malloc(max_items*sizeof(int32_t));
+  struct modlist_ioc_buf ioc;
+  long nr_items=0, ret, i;
+  double start;
+  int fd;
+
+  if (!items)
+	err(1,"malloc");
+  if ((fd=open(path,O_RDONLY))<0)
+	err(1,"%s",path);
+
+  *sum=0;
+  start=now();
+  do {
+	ioc.data=(uintptr_t)(items+nr_items);
+	ioc.nr_items=max_items-nr_items;
+	ioc.offset=nr_items;
+	if ((ret=ioctl(fd,MODLIST_IOC_EXPORT,&ioc))<0)
+		err(1,"ioctl export %s",path);
+	nr_items+=ret;
+  } while (ret>0 && nr_items<max_items);
+  report("binary read",nr_items,nr_items*sizeof(int32_t),now()-start);
+
+  for (i=0;i<nr_items;i++)
+	*sum+=items[i];
+
+  close(fd);
+  free(items);
+  return nr_items;
+}
+
+/* Text interface: a batch that mixes adds with remove and cleanup. The adds
+   after a command that empties the list can't reuse the nodes of the first ones */
+static void text_mixed (const char* path) {
+  const char* cmds="add 1\ncleanup\nadd 2\nadd 3\nremove 2\nremove 3\nadd 4\nadd 5\n";
+  struct modlist_ioc_buf ioc;
+  int32_t items[4];
+  long ret;
+  int fd;
+
+  if ((ret=write_str(path,cmds))<0)
+	errx(1,"mixed batch %s: %s",path,strerror(-ret));
+
+  if ((fd=open(path,O_RDONLY))<0)
+	err(1,"%s",path);
+  ioc.data=(uintptr_t)items;
+  ioc.nr_items=4;
+  ioc.offset=0;
+  if ((ret=ioctl(fd,MODLIST_IOC_EXPORT,&ioc))<0)
+	err(1,"ioctl export %s",path);
+  if (ret!=2 || items[0]!=4 || items[1]!=5)
+	errx(1,"mixed batch left %ld items (expected 4 and 5)",ret);
+
+  close(fd);
+  write_str(path,"cleanup\n");
+}
+
+/* Text interface: one "remove N" command per value, all in one write().
+   Returns the number of items left in the list */
+static long text_remove (const char* path, int32_t* values, long nr_values) {
+  char* cmds=malloc(nr_values*20+1);
+  size_t len=0;
+  long i, left;
+  double start;
+  int fd;
+
+  if (!cmds)
+	err(1,"malloc");
+  for (i=0;i<nr_values;i++)
+	len+=sprintf(cmds+len,"remove %d\n",values[i]);
+
+  if ((fd=open(path,O_WRONLY))<0)
+	err(1,"%s",path);
+
+  start=now();
+  if (write(fd,cmds,len)!=len)
+	err(1,"write %s",path);
+  report("text remove",nr_values,len,now()-start);
+
+  if ((left=ioctl(fd,MODLIST_IOC_COUNT))<0)
+	err(1,"ioctl count %s",path);
+
+  close(fd);
+  free(cmds);
+  return left;
+}
+
+static void
+uso (int status)
+{
+  if (status != EXIT_SUCCESS)
+    warnx("Pruebe `%s -h' para obtener mas informacion.\n", nombre_programa);
+  else
+    {
+      printf ("Uso: %s [OPCIONES]\n", nombre_programa);
+fputs ("\
+  -n <num>,   numero de enteros a transferir (por defecto 100000)\n\
+  -l <lista>, nombre de la lista a crear en " PROC_DIR " (por defecto bench)\n\
+  -m <modo>,  almacenamiento de la lista: list, sorted o chunked (por defecto list)\n\
+  -r <num>,   numero de valores a borrar con \"remove\" (por defecto 100)\n\
+", stdout);
+      fputs ("\
+  -h,	Muestra este breve recordatorio de uso\n\
+", stdout);
+    }
+    exit (status);
+}
+
+int
+main (int argc, char **argv)
+{
+  int optc, ret;
+  long nr_items=DEFAULT_NR_ITEMS, nr_removes=DEFAULT_NR_REMOVES, got, expected, i, j;
+  const char* name="bench";
+  const char* mode="list";
+  char path[256], cmd[64];
+  int32_t* items;
+  int64_t sum=0, text_sum, bin_sum;
+  nombre_programa = argv[0];
+
+  while ((optc = getopt (argc, argv, "hn:l:m:r:")) != -1)
+    {
+      switch (optc)
+	{
+
+	case 'h':
+	  uso(EXIT_SUCCESS);
+	  break;
+	
+	case 'n':
+	  nr_items=atol(optarg);
+	  break;
+
+	case 'l':
+	  name=optarg;
+	  break;	
+
+	case 'm':
+	  mode=optarg;
+	  break;
+
+	case 'r':
+	  nr_removes=atol(optarg);
+	  break;
+
+	default:
+	  uso (EXIT_FAILURE);
+	}
+    }
+
+  if (nr_items<=0 || nr_removes<0 || nr_removes>nr_items)
+	uso(EXIT_FAILURE);
+
+  items=malloc(nr_items*sizeof(int32_t));
+  if (!items)
+	err(1,"malloc");
+  srand(time(NULL));
+  for (i=0;i<nr_items;i++) {
+	items[i]=rand()-RAND_MAX/2;
+	sum+=items[i];
+  }
+
+  snprintf(cmd,sizeof(cmd),"create %s %s\n",name,mode);
+  if ((ret=write_str(PROC_DIR "/control",cmd))<0 && ret!=-EEXIST)
+	errx(1,"create %s %s: %s",name,mode,strerror(-ret));
+  if (ret==-EEXIST)
+	warnx("%s already exists, its storage mode may not be %s",name,mode);
+  snprintf(path,sizeof(path),PROC_DIR "/%s",name);
+  write_str(path,"cleanup\n");
+
+  /* /proc text interface */
+  text_mixed(path);
+  text_import(path,items,nr_items);
+  got=text_export(path,&text_sum);
+  if (got!=nr_items || text_sum!=sum)
+	errx(1,"text read returned %ld items (expected %ld)",got,nr_items);
+  write_str(path,"cleanup\n");
+
+  /* ioctl binary interface */
+  binary_import(path,items,nr_items);
+  got=binary_export(path,nr_items,&bin_sum);
+  if (got!=nr_items || bin_sum!=sum)
+	errx(1,"binary read returned %ld items (expected %ld)",got,nr_items);
+
+  /* Remove the values of the first nr_removes items (and their duplicates) */
+  expected=0;
+  for (i=0;i<nr_items;i++) {
+	for (j=0;j<nr_removes && items[i]!=items[j];j++)
+		;
+	if (j==nr_removes)
+		expected++;
+  }
+  if (nr_removes>0 && (got=text_remove(path,items,nr_removes))!=expected)
+	errx(1,"%ld items left after remove (expected %ld)",got,expected);
+
+  snprintf(cmd,sizeof(cmd),"remove %s\n",name);
+  write_str(PROC_DIR "/control",cmd);
+
+  free(items);
+  exit (EXIT_SUCCESS);
+}
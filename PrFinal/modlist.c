@@ -1,64 +1,181 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include <asm-generic/uaccess.h>
 #include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/rbtree.h>
 #include <linux/spinlock.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include "modlist_ioctl.h"
 
 MODULE_LICENSE("GPL");
 
 #define BUFFER_LENGTH 240
 #define ENTRY_NAME_LENGTH 20
+#define MODE_NAME_LENGTH 16
+#define LISTS_HASH_BITS 10 /* 1024 buckets for the name index */
+#define WRITE_CHUNK_LENGTH (PAGE_SIZE-1) /* max bytes of commands applied at once */
+#define CHUNK_SIZE PAGE_SIZE /* size of the arrays of a MODE_CHUNKED entry */
+
+/* commands accepted by the list entries */
+enum {
+  CMD_NONE,
+  CMD_ADD,
+  CMD_REMOVE,
+  CMD_CLEANUP
+};
+
+/* storage of a list entry, chosen with "create <name> [mode]" */
+enum {
+  MODE_LIST,   /* insertion order, readers don't take any lock */
+  MODE_SORTED, /* ascending order, O(log n) add/remove */
+  MODE_CHUNKED /* insertion order, packed in page-sized arrays */
+};
 
 static struct proc_dir_entry *proc_control_entry;
+static struct proc_dir_entry *proc_stats_entry;
 static struct proc_dir_entry *proc_dir=NULL;
 
-/* list items */
+/* list items. Readers walk the lists under RCU, so nodes are freed after a grace period */
 typedef struct {
     int data;
     struct list_head links;
+    struct rcu_head rcu;
 } list_item_t;
 
+static struct kmem_cache *item_cache; /* slab cache for list_item_t nodes */
+static atomic_t items_in_use = ATOMIC_INIT(0);
+
+/* sorted entries keep one rbtree node per distinct value. Readers hold the entry lock */
+typedef struct {
+    int data;
+    unsigned int count; /* copies of data in the list */
+    struct rb_node node;
+} sorted_item_t;
+
+static struct kmem_cache *sorted_cache; /* slab cache for sorted_item_t nodes */
+static atomic_t sorted_in_use = ATOMIC_INIT(0);
+
+/* chunked entries ("unrolled list") store the elements in arrays of
+*  CHUNK_CAPACITY ints. Every chunk but the last one is kept full, so a
+*  remove compacts the elements that follow. Readers hold the entry lock */
+typedef struct {
+    struct list_head links;
+    unsigned int nr; /* used slots of data[] */
+    int data[];
+} chunk_t;
+
+#define CHUNK_CAPACITY ((CHUNK_SIZE - sizeof(chunk_t)) / sizeof(int))
+
+static struct kmem_cache *chunk_cache; /* slab cache for chunk_t arrays */
+static atomic_t chunks_in_use = ATOMIC_INIT(0);
+
 /* proc entry items */
 typedef struct {
     struct proc_dir_entry* proc_entry;
-    struct list_head list;
+    int mode;
+    struct list_head list; /* MODE_LIST items or MODE_CHUNKED chunks */
+    struct rb_root tree;   /* MODE_SORTED */
     struct list_head links;
-    spinlock_t sp;
+    struct hlist_node hnode; /* node in lists_by_name */
+    spinlock_t sp; /* serializes writers of this entry (and readers of sorted ones) */
     char name[ENTRY_NAME_LENGTH];
     int marked_for_removal; // better than sudden removal
+    unsigned long gen; /* bumped before positions change, see bump_gen() */
+    struct rcu_head rcu;
 } entry_list_node_t;
 
+/* seq_file iterator of a list entry, one per open file */
+typedef struct {
+    entry_list_node_t *entry;
+    void *cur; /* list_item_t, sorted_item_t or chunk_t at position 'pos' */
+    unsigned int sub; /* copies of cur->data already shown (MODE_SORTED) or
+                         index in cur->data[] (MODE_CHUNKED) */
+    loff_t pos;
+    unsigned long gen; /* entry->gen when 'cur' was found */
+} modlist_iter_t;
+
 struct list_head list_of_proc_lists;
+/* Name index over list_of_proc_lists. Writers hold sp_lists, readers use RCU */
+static DEFINE_HASHTABLE(lists_by_name, LISTS_HASH_BITS);
 DEFINE_SPINLOCK(sp_lists);
 
 static ssize_t control_write(struct file *filp, const char __user *buf, size_t len, loff_t *off);
-static ssize_t control_create(char* name);
+static ssize_t control_create(char* name, int mode);
 static void control_remove(entry_list_node_t *modlist_entry);
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
+static entry_list_node_t* lookup_entry(const char* name);
+static int modlist_open(struct inode *inode, struct file *file);
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos);
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos);
+static void modlist_seq_stop(struct seq_file *m, void *v);
+static int modlist_seq_show(struct seq_file *m, void *v);
+static void bump_gen(entry_list_node_t *entry_node);
+static long modlist_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off);
+static ssize_t stats_read(struct file *filp, char __user *buf, size_t len, loff_t *off);
+static list_item_t* alloc_item(int data);
+static void free_item(list_item_t *item);
+static void destroy_caches(void);
+static unsigned int nodes_needed(entry_list_node_t *entry_node, unsigned int nr_adds);
+static void* alloc_node(entry_list_node_t *entry_node);
+static void discard_node(entry_list_node_t *entry_node, void *node);
+static int entry_add(entry_list_node_t *entry_node, int num, void *node);
+static void entry_remove(entry_list_node_t *entry_node, int num);
+static void entry_cleanup(entry_list_node_t *entry_node);
 
 static const struct file_operations proc_control_fops = {
     .write = control_write,    
 };
 
+static const struct file_operations proc_stats_fops = {
+    .read = stats_read,
+};
+
+static const struct seq_operations modlist_seq_ops = {
+    .start = modlist_seq_start,
+    .next = modlist_seq_next,
+    .stop = modlist_seq_stop,
+    .show = modlist_seq_show,
+};
+
 static const struct file_operations proc_entry_fops = {
-    .read = modlist_read,
+    .open = modlist_open,
+    .read = seq_read,
+    .llseek = seq_lseek,
+    .release = seq_release_private,
     .write = modlist_write,    
+    .unlocked_ioctl = modlist_ioctl,
+    .compat_ioctl = modlist_ioctl,
 };
 
 int init_modlist_module( void )
 {
   /* Init list of proc entries */
   INIT_LIST_HEAD(&list_of_proc_lists);
+  hash_init(lists_by_name);
   spin_lock_init(&sp_lists);
 
+  /* Create slab cache for the list nodes */
+  item_cache = kmem_cache_create("multilist_item", sizeof(list_item_t), 0, 0, NULL);
+  sorted_cache = kmem_cache_create("multilist_sorted_item", sizeof(sorted_item_t), 0, 0, NULL);
+  chunk_cache = kmem_cache_create("multilist_chunk", CHUNK_SIZE, 0, 0, NULL);
+  if (item_cache == NULL || sorted_cache == NULL || chunk_cache == NULL) {
+    printk(KERN_INFO "multilist: Can't create slab cache\n");
+    destroy_caches();
+    return -ENOMEM;
+  }
+
   /* Create proc directory */
   proc_dir = proc_mkdir("multilist", NULL);
   if (proc_dir == NULL) {
     printk(KERN_INFO "multilist: Can't create /proc directory\n");
+    destroy_caches();
     return -ENOMEM;
   }
 
@@ -66,10 +183,22 @@ int init_modlist_module( void )
   proc_control_entry = proc_create("control", 0666, proc_dir, &proc_control_fops);
   if (proc_control_entry == NULL) {
     printk(KERN_INFO "multilist: Can't create 'control' entry\n");
+    remove_proc_entry("multilist", NULL);
+    destroy_caches();
+    return -ENOMEM;
+  }
+
+  /* Create proc entry /proc/multilist/stats */
+  proc_stats_entry = proc_create("stats", 0444, proc_dir, &proc_stats_fops);
+  if (proc_stats_entry == NULL) {
+    printk(KERN_INFO "multilist: Can't create 'stats' entry\n");
+    remove_proc_entry("control", proc_dir);
+    remove_proc_entry("multilist", NULL);
+    destroy_caches();
     return -ENOMEM;
   }
 
-  control_create("default");
+  control_create("default", MODE_LIST);
 
   printk(KERN_INFO "multilist: Module loaded.\n");
   try_module_get(THIS_MODULE);
@@ -81,13 +210,18 @@ void exit_modlist_module( void )
 {
   entry_list_node_t *tmp, *pos;
 
-  remove_proc_entry("control", proc_dir);
-  remove_proc_entry("multilist", NULL);
-
   /* Remove entries that haven't been manually deleted */
   list_for_each_entry_safe(pos, tmp, &list_of_proc_lists, links) {
     control_remove(pos);
   }
+
+  remove_proc_entry("stats", proc_dir);
+  remove_proc_entry("control", proc_dir);
+  remove_proc_entry("multilist", NULL);
+
+  /* Wait for the pending free_item() callbacks before destroying the cache */
+  rcu_barrier();
+  destroy_caches();
     
   printk(KERN_INFO "multilist: Module unloaded.\n");
   module_put(THIS_MODULE);
@@ -96,9 +230,10 @@ void exit_modlist_module( void )
 
 static ssize_t control_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
   char aux_buffer[BUFFER_LENGTH];
-  char modlistbuffer[BUFFER_LENGTH];
   int available_space = BUFFER_LENGTH-1;
   char name[ENTRY_NAME_LENGTH];
+  char mode[MODE_NAME_LENGTH];
+  int nr_args;
 
   if ((*off) > 0) /* The application can write in this entry just once !! */
     return 0;
@@ -113,21 +248,27 @@ static ssize_t control_write(struct file *filp, const char __user *buf, size_t l
   
   aux_buffer[len] = '\0';
 
-  if(sscanf(modlistbuffer, "create %s", name) == 1) {
-    control_create(name);
+  if((nr_args = sscanf(aux_buffer, "create %19s %15s", name, mode)) >= 1) {
+    ssize_t ret;
+
+    if (nr_args == 1 || strcmp(mode, "list") == 0)
+      ret = control_create(name, MODE_LIST);
+    else if (strcmp(mode, "sorted") == 0)
+      ret = control_create(name, MODE_SORTED);
+    else if (strcmp(mode, "chunked") == 0)
+      ret = control_create(name, MODE_CHUNKED);
+    else
+      ret = -EINVAL;
+
+    if (ret < 0)
+      return ret;
   }
-  else if (sscanf(modlistbuffer, "remove %s", name) == 1) {
-    int found = 0;
-    entry_list_node_t *modlist_entry, *temp;
+  else if (sscanf(aux_buffer, "remove %19s", name) == 1) {
+    entry_list_node_t *modlist_entry;
 
     spin_lock(&sp_lists);
-    list_for_each_entry_safe(modlist_entry, temp, &list_of_proc_lists, links) {
-      if (!strcmp(modlist_entry->name, name)) {
-          found = 1;
-          break;
-      }
-    }
-    if (!found) {
+    modlist_entry = lookup_entry(name);
+    if (modlist_entry == NULL) {
       printk(KERN_INFO "multilist: non-existing entry remove\n");
       spin_unlock(&sp_lists);
       return -ENOENT;
@@ -135,16 +276,13 @@ static ssize_t control_write(struct file *filp, const char __user *buf, size_t l
 
     /* It's better to have a marked so that different processes
     *  won't cause deadlock to each other */
-    spin_lock(&modlist_entry->sp);
     if (modlist_entry->marked_for_removal) {
-      spin_unlock(&modlist_entry->sp);
       spin_unlock(&sp_lists);
       return len;
     }
     modlist_entry->marked_for_removal = 1;
-    spin_unlock(&modlist_entry->sp);
-    
     spin_unlock(&sp_lists);
+
     control_remove(modlist_entry);
   }
 
@@ -153,149 +291,762 @@ static ssize_t control_write(struct file *filp, const char __user *buf, size_t l
   return len;
 }
 
-static ssize_t control_create(char* name) {
-  entry_list_node_t *entry_node = vmalloc(sizeof(entry_list_node_t));;
+/* Looks an entry up by name in the hash index. Call with sp_lists held or inside rcu_read_lock() */
+static entry_list_node_t* lookup_entry(const char* name) {
+  entry_list_node_t *entry_node;
+  u32 key = jhash(name, strlen(name), 0);
+
+  hash_for_each_possible_rcu(lists_by_name, entry_node, hnode, key) {
+    if (!strcmp(entry_node->name, name))
+      return entry_node;
+  }
+
+  return NULL;
+}
+
+static ssize_t control_create(char* name, int mode) {
+  entry_list_node_t *entry_node = kmalloc(sizeof(entry_list_node_t), GFP_KERNEL);
+
+  if (entry_node == NULL)
+    return -ENOMEM;
+
   /* Create data for the proc entry */
+  entry_node->mode = mode;
   INIT_LIST_HEAD(&entry_node->list);
+  entry_node->tree = RB_ROOT;
 
   spin_lock_init(&entry_node->sp);
   entry_node->proc_entry = NULL;
-  entry_node->marked_for_removal = 0;
+  entry_node->marked_for_removal = 1; /* nobody can remove it until it is complete */
+  entry_node->gen = 0;
   strncpy(entry_node->name, name, ENTRY_NAME_LENGTH);
+  entry_node->name[ENTRY_NAME_LENGTH-1] = '\0';
 
-  entry_node->proc_entry = proc_create_data(name, 0666, proc_dir, &proc_entry_fops, entry_node);
+  /* Reserve the name before creating the proc entry, so that two
+  *  concurrent creates of the same list can't both succeed */
+  spin_lock(&sp_lists);
+  if (lookup_entry(entry_node->name) != NULL) {
+    spin_unlock(&sp_lists);
+    printk(KERN_INFO "multilist: entry %s already exists\n", entry_node->name);
+    kfree(entry_node);
+    return -EEXIST;
+  }
+  hash_add_rcu(lists_by_name, &entry_node->hnode, jhash(entry_node->name, strlen(entry_node->name), 0));
+  list_add_tail_rcu(&entry_node->links, &list_of_proc_lists);
+  spin_unlock(&sp_lists);
+
+  entry_node->proc_entry = proc_create_data(entry_node->name, 0666, proc_dir, &proc_entry_fops, entry_node);
   
   if (entry_node->proc_entry == NULL) {
     spin_lock(&sp_lists);
-    vfree(entry_node);
-    return 0;
+    hash_del_rcu(&entry_node->hnode);
+    list_del_rcu(&entry_node->links);
+    spin_unlock(&sp_lists);
+    kfree_rcu(entry_node, rcu);
+    return -ENOMEM;
   }
 
   spin_lock(&sp_lists);
-  list_add_tail(&entry_node->links, &list_of_proc_lists); 
+  entry_node->marked_for_removal = 0;
   spin_unlock(&sp_lists);
 
   return 0;
 }
 
 static void control_remove(entry_list_node_t *modlist_entry) {
-  list_item_t *pos;
-  list_item_t *temp;
-
+  /* Waits for the readers that are still inside the proc entry */
   remove_proc_entry( modlist_entry->name, proc_dir);
 
-  /* Remove from list of lists */
+  /* Remove from list of lists and from the name index */
   spin_lock(&sp_lists);
-  list_del(&modlist_entry->links);
+  hash_del_rcu(&modlist_entry->hnode);
+  list_del_rcu(&modlist_entry->links);
   spin_unlock(&sp_lists);
 
   spin_lock(&modlist_entry->sp);
-  list_for_each_entry_safe(pos, temp, &modlist_entry->list, links) {
-    list_del(&pos->links);
-    vfree(pos);
-  }
+  entry_cleanup(modlist_entry);
   spin_unlock(&modlist_entry->sp);
 
-  vfree(modlist_entry);
+  kfree_rcu(modlist_entry, rcu);
 }
 
-static ssize_t modlist_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
-  list_item_t *pos;
-  int nchars, nbytes, ret = 0;
-  char *buff_pos = buf;
+/* Read side of the list entries, through seq_file.
+*  Every read() walks the list between start() and stop(), under RCU for
+*  MODE_LIST entries and with the entry lock held for the others. The
+*  position reached is saved in the iterator so that the next read() can
+*  resume there instead of walking the list from the beginning again */
+static void *modlist_seq_start(struct seq_file *m, loff_t *pos) {
+  modlist_iter_t *iter = m->private;
+  entry_list_node_t *entry_node = iter->entry;
+  list_item_t *item;
+  sorted_item_t *sitem;
+  chunk_t *chunk;
+  struct rb_node *node;
+  unsigned long gen;
+  loff_t n = *pos;
 
-  entry_list_node_t *entry_node;
-  char int_buf[20];  
+  if (entry_node->mode == MODE_LIST)
+    rcu_read_lock();
+  else
+    spin_lock(&entry_node->sp);
 
-  if ((*off) > 0) /* Tell the application that there is nothing left to read */
-    return 0;
+  gen = READ_ONCE(entry_node->gen);
+  smp_rmb(); /* pairs with smp_wmb() in bump_gen() */
 
-  entry_node = (entry_list_node_t*)PDE_DATA(filp->f_inode);
+  /* The saved item can't have been freed if nothing was unlinked since */
+  if (iter->cur != NULL && iter->pos == *pos && iter->gen == gen)
+    return iter;
 
-  spin_lock(&sp_lists);
-  spin_lock(&entry_node->sp);
-  /* copiar los datos al buffer de modlist */
-  list_for_each_entry(pos, &entry_node->list, links) {
-    nchars = sprintf(int_buf, "%d\n", pos->data);
-    nbytes = nchars*sizeof(char); // with the \n char
-    if ( (nbytes) > (len-ret) ) // if there is space in buffer
-      break;
+  iter->cur = NULL;
+  iter->sub = 0;
+  iter->pos = *pos;
+  iter->gen = gen;
 
-    /* Transfer data from the kernel to userspace  */ 
-    if( copy_to_user(buff_pos, int_buf, nbytes) ) {
-      spin_unlock(&entry_node->sp);
-      spin_unlock(&sp_lists);
-      return -EFAULT;
+  switch (entry_node->mode) {
+  case MODE_LIST:
+    list_for_each_entry_rcu(item, &entry_node->list, links) {
+      if (n-- == 0) {
+        iter->cur = item;
+        break;
+      }
     }
+    break;
+  case MODE_SORTED:
+    for (node = rb_first(&entry_node->tree); node; node = rb_next(node)) {
+      sitem = rb_entry(node, sorted_item_t, node);
+      if (n < sitem->count) {
+        iter->cur = sitem;
+        iter->sub = n;
+        break;
+      }
+      n -= sitem->count;
+    }
+    break;
+  case MODE_CHUNKED:
+    list_for_each_entry(chunk, &entry_node->list, links) {
+      if (n < chunk->nr) {
+        iter->cur = chunk;
+        iter->sub = n;
+        break;
+      }
+      n -= chunk->nr;
+    }
+    break;
+  }
+
+  return iter->cur ? iter : NULL;
+}
+
+static void *modlist_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+  modlist_iter_t *iter = v;
+  list_item_t *item;
+  sorted_item_t *sitem;
+  chunk_t *chunk;
+  struct list_head *next;
+  struct rb_node *node;
 
-    buff_pos += nchars;
-    ret += nbytes;
+  (*pos)++;
+  iter->pos = *pos;
+
+  switch (iter->entry->mode) {
+  case MODE_LIST:
+    item = iter->cur;
+    next = rcu_dereference(list_next_rcu(&item->links));
+    iter->cur = (next == &iter->entry->list) ? NULL : list_entry_rcu(next, list_item_t, links);
+    break;
+  case MODE_SORTED:
+    sitem = iter->cur;
+    if (++iter->sub == sitem->count) {
+      node = rb_next(&sitem->node);
+      iter->cur = node ? rb_entry(node, sorted_item_t, node) : NULL;
+      iter->sub = 0;
+    }
+    break;
+  case MODE_CHUNKED:
+    chunk = iter->cur;
+    if (++iter->sub == chunk->nr) {
+      iter->cur = list_is_last(&chunk->links, &iter->entry->list) ? NULL : list_next_entry(chunk, links);
+      iter->sub = 0;
+    }
+    break;
   }
 
-  spin_unlock(&entry_node->sp);
-  spin_unlock(&sp_lists);    
+  return iter->cur ? iter : NULL;
+}
+
+static void modlist_seq_stop(struct seq_file *m, void *v) {
+  modlist_iter_t *iter = m->private;
+
+  if (iter->entry->mode == MODE_LIST)
+    rcu_read_unlock();
+  else
+    spin_unlock(&iter->entry->sp);
+}
 
-  (*off)+=ret;  /* Update the file pointer */
+/* Element at the position of the iterator */
+static int iter_data(modlist_iter_t *iter) {
+  switch (iter->entry->mode) {
+  case MODE_SORTED:
+    return ((sorted_item_t*)iter->cur)->data;
+  case MODE_CHUNKED:
+    return ((chunk_t*)iter->cur)->data[iter->sub];
+  default:
+    return ((list_item_t*)iter->cur)->data;
+  }
+}
+
+static int modlist_seq_show(struct seq_file *m, void *v) {
+  seq_printf(m, "%d\n", iter_data(v));
+  return 0;
+}
+
+static int modlist_open(struct inode *inode, struct file *file) {
+  modlist_iter_t *iter = __seq_open_private(file, &modlist_seq_ops, sizeof(modlist_iter_t));
+
+  if (iter == NULL)
+    return -ENOMEM;
 
+  iter->entry = (entry_list_node_t*)PDE_DATA(inode);
+  return 0;
+}
+
+/* Invalidates the cursors saved by readers. Call with the entry lock held,
+*  before unlinking any item (or inserting one in a sorted entry) */
+static void bump_gen(entry_list_node_t *entry_node) {
+  WRITE_ONCE(entry_node->gen, entry_node->gen + 1);
+  smp_wmb();
+}
+
+/* A command parsed from one line of the write buffer */
+typedef struct {
+  int cmd;
+  int num;
+} command_t;
+
+/* Parses one line of the write buffer */
+static int parse_command(char *line, int *num) {
+  line = strim(line);
+
+  if (*line == '\0')
+    return CMD_NONE;
+  if (sscanf(line, "add %i", num) == 1)
+    return CMD_ADD;
+  if (sscanf(line, "remove %i", num) == 1)
+    return CMD_REMOVE;
+  if (strcmp(line, "cleanup") == 0)
+    return CMD_CLEANUP;
+
+  return CMD_NONE;
+}
+
+/* Applies the newline-separated commands in 'cmds' under a single
+*  acquisition of the entry lock. The nodes for the "add" commands are
+*  allocated beforehand, so either every command is applied or none */
+static int apply_commands(entry_list_node_t *entry_node, char *cmds, size_t len) {
+  command_t *cmdv;
+  void **nodes = NULL;
+  unsigned int max_cmds = 1, nr_cmds = 0, nr_adds = 0, nr_nodes = 0, used = 0, i;
+  char *line, *cur = cmds;
+  int ret = 0;
+
+  /* 1st pass: parse every line once and allocate the new nodes (may sleep).
+     The 2nd pass only runs what was parsed here, so both see the same adds */
+  for (i = 0; i < len; i++) {
+    if (cmds[i] == '\n')
+      max_cmds++;
+  }
+
+  cmdv = kmalloc_array(max_cmds, sizeof(command_t), GFP_KERNEL);
+  if (cmdv == NULL)
+    return -ENOMEM;
+
+  while ((line = strsep(&cur, "\n")) != NULL) {
+    cmdv[nr_cmds].cmd = parse_command(line, &cmdv[nr_cmds].num);
+    if (cmdv[nr_cmds].cmd == CMD_NONE)
+      continue;
+    if (cmdv[nr_cmds].cmd == CMD_ADD)
+      nr_adds++;
+    else {
+      /* A remove or cleanup may leave the entry empty (or the last chunk
+         of a chunked one with any number of free slots), so the adds
+         that follow can't reuse the room counted for the previous ones */
+      nr_nodes += nodes_needed(entry_node, nr_adds);
+      nr_adds = 0;
+    }
+    nr_cmds++;
+  }
+
+  nr_nodes += nodes_needed(entry_node, nr_adds);
+  if (nr_nodes > 0) {
+    nodes = kmalloc_array(nr_nodes, sizeof(void*), GFP_KERNEL);
+    if (nodes == NULL) {
+      ret = -ENOMEM;
+      goto out;
+    }
+
+    for (i = 0; i < nr_nodes; i++) {
+      nodes[i] = alloc_node(entry_node);
+      if (nodes[i] == NULL) {
+        while (i-- > 0)
+          discard_node(entry_node, nodes[i]);
+        kfree(nodes);
+        ret = -ENOMEM;
+        goto out;
+      }
+    }
+  }
+
+  /* 2nd pass: apply every command in order */
+  spin_lock(&entry_node->sp);
+  for (i = 0; i < nr_cmds; i++) {
+    switch (cmdv[i].cmd) {
+    case CMD_ADD:
+      used += entry_add(entry_node, cmdv[i].num, used < nr_nodes ? nodes[used] : NULL);
+      break;
+    case CMD_REMOVE:
+      entry_remove(entry_node, cmdv[i].num);
+      break;
+    case CMD_CLEANUP:
+      entry_cleanup(entry_node);
+      break;
+    }
+  }
+  spin_unlock(&entry_node->sp);
+
+  /* Duplicated values in a sorted entry, or free slots in the last
+     chunk of a chunked one, leave some nodes unused */
+  for (i = used; i < nr_nodes; i++)
+    discard_node(entry_node, nodes[i]);
+  kfree(nodes);
+out:
+  kfree(cmdv);
   return ret;
 }
 
+/* Accepts any number of newline-separated commands ("add 1\nadd 2\nremove 7\n...").
+*  The buffer is processed in page-sized chunks that end on a line boundary;
+*  a command that doesn't fit in one page is rejected */
 static ssize_t modlist_write(struct file *filp, const char __user *buf, size_t len, loff_t *off) {
-  char aux_buffer[BUFFER_LENGTH] = "\0";
-  char modlistbuffer[BUFFER_LENGTH];
-  list_item_t *pos, *temp;
   entry_list_node_t *entry_node;
-  int num = 0;
-  
-  if ((*off) > 0) /* The application can write in this entry just once !! */
-    return 0;
+  char *chunk;
+  size_t done = 0, nbytes, consumed;
+  int ret = 0;
 
   entry_node = (entry_list_node_t*)PDE_DATA(filp->f_inode);
-  
-  /* Transfer data from user to kernel space */
-  if (copy_from_user(aux_buffer, buf, len)) {
-    return -EFAULT;
+
+  chunk = (char*)__get_free_page(GFP_KERNEL);
+  if (chunk == NULL)
+    return -ENOMEM;
+
+  while (done < len) {
+    nbytes = min_t(size_t, len - done, WRITE_CHUNK_LENGTH);
+
+    /* Transfer data from user to kernel space */
+    if (copy_from_user(chunk, buf + done, nbytes)) {
+      ret = -EFAULT;
+      break;
+    }
+
+    /* Leave an incomplete last line for the next chunk */
+    consumed = nbytes;
+    if (done + nbytes < len) {
+      while (consumed > 0 && chunk[consumed-1] != '\n')
+        consumed--;
+      if (consumed == 0) {
+        printk(KERN_INFO "multilist: command too long!!\n");
+        ret = -EINVAL;
+        break;
+      }
+    }
+    chunk[consumed] = '\0'; /* Add the `\0' */
+
+    /* The commands are text: a NUL byte would hide the lines after it */
+    if (memchr(chunk, '\0', consumed) != NULL) {
+      ret = -EINVAL;
+      break;
+    }
+
+    ret = apply_commands(entry_node, chunk, consumed);
+    if (ret < 0)
+      break;
+
+    done += consumed;
   }
 
-  aux_buffer[len] = '\0'; /* Add the `\0' */
+  free_page((unsigned long)chunk);
 
-  // optamos por no hacer métodos para cada operación porque no merece la pena
-  if(sscanf(modlistbuffer, "add %i", &num) == 1) {
+  /* Report the bytes already applied, so that the caller can resume after them */
+  if (done == 0 && ret < 0)
+    return ret;
 
-    temp = vmalloc(sizeof(list_item_t));
-    temp->data = num;
+  (*off)+=done; /* Update the file pointer */
 
-    spin_lock(&entry_node->sp);
-    list_add_tail(&temp->links, &entry_node->list);
-	spin_unlock(&entry_node->sp);
+  return done;
+}
 
-	}
-  else if(sscanf(modlistbuffer, "remove %i", &num) == 1) {
+/* Bulk transfer of packed int32 arrays (see modlist_ioctl.h) */
+static long modlist_ioctl(struct file *filp, unsigned int cmd, unsigned long arg) {
+  entry_list_node_t *entry_node = (entry_list_node_t*)PDE_DATA(filp->f_inode);
+  struct modlist_ioc_buf ioc;
+  list_item_t *pos;
+  chunk_t *chunk;
+  struct rb_node *node;
+  void **nodes;
+  s32 *kbuf;
+  long count = 0;
+  unsigned int i, nr_nodes, used = 0;
 
-    spin_lock(&entry_node->sp);
-    list_for_each_entry_safe(pos, temp, &entry_node->list, links) {
-        if (pos->data == num) {          
-            list_del(&pos->links);
-            vfree(pos);
-        }
+  if (_IOC_TYPE(cmd) != MODLIST_IOC_MAGIC)
+    return -ENOTTY;
+
+  if (cmd == MODLIST_IOC_COUNT) {
+    if (entry_node->mode == MODE_LIST) {
+      rcu_read_lock();
+      list_for_each_entry_rcu(pos, &entry_node->list, links)
+        count++;
+      rcu_read_unlock();
     }
-    spin_unlock(&entry_node->sp);
+    else if (entry_node->mode == MODE_SORTED) {
+      spin_lock(&entry_node->sp);
+      for (node = rb_first(&entry_node->tree); node; node = rb_next(node))
+        count += rb_entry(node, sorted_item_t, node)->count;
+      spin_unlock(&entry_node->sp);
+    }
+    else {
+      spin_lock(&entry_node->sp);
+      list_for_each_entry(chunk, &entry_node->list, links)
+        count += chunk->nr;
+      spin_unlock(&entry_node->sp);
+    }
+    return count;
+  }
+
+  if (cmd != MODLIST_IOC_EXPORT && cmd != MODLIST_IOC_IMPORT)
+    return -ENOTTY;
+
+  if (copy_from_user(&ioc, (void __user *)arg, sizeof(ioc)))
+    return -EFAULT;
+
+  if (ioc.nr_items == 0)
+    return 0;
+  if (ioc.nr_items > MODLIST_IOC_MAX_ITEMS)
+    ioc.nr_items = MODLIST_IOC_MAX_ITEMS;
 
+  kbuf = vmalloc(ioc.nr_items * sizeof(s32));
+  if (kbuf == NULL)
+    return -ENOMEM;
+
+  if (cmd == MODLIST_IOC_EXPORT) {
+    struct seq_file *m = filp->private_data;
+    loff_t ppos = ioc.offset;
+    void *v;
+
+    /* Walk with the seq_file iterator of this file: it keeps the position
+    *  reached, so paging through the list with consecutive offsets resumes
+    *  there instead of walking it from the head on every call */
+    mutex_lock(&m->lock);
+    for (v = modlist_seq_start(m, &ppos); v != NULL && count < ioc.nr_items; v = modlist_seq_next(m, v, &ppos))
+      kbuf[count++] = iter_data(v);
+    modlist_seq_stop(m, v);
+    mutex_unlock(&m->lock);
+
+    /* Transfer data from the kernel to userspace in one go */
+    if (copy_to_user((void __user *)(unsigned long)ioc.data, kbuf, count * sizeof(s32)))
+      count = -EFAULT;
   }
-  else if(strcmp(modlistbuffer, "cleanup\n") == 0) {
+  else {
+    /* Transfer data from user to kernel space in one go */
+    if (copy_from_user(kbuf, (void __user *)(unsigned long)ioc.data, ioc.nr_items * sizeof(s32))) {
+      vfree(kbuf);
+      return -EFAULT;
+    }
+
+    nr_nodes = nodes_needed(entry_node, ioc.nr_items);
+    nodes = vmalloc(nr_nodes * sizeof(void*));
+    if (nodes == NULL) {
+      vfree(kbuf);
+      return -ENOMEM;
+    }
+
+    /* Import as many items as we manage to allocate */
+    for (i = 0; i < nr_nodes; i++) {
+      nodes[i] = alloc_node(entry_node);
+      if (nodes[i] == NULL)
+        break;
+    }
+    if (i < nr_nodes)
+      ioc.nr_items = (entry_node->mode == MODE_CHUNKED) ? i * CHUNK_CAPACITY : i;
 
     spin_lock(&entry_node->sp);
+    for (count = 0; count < ioc.nr_items; count++)
+      used += entry_add(entry_node, kbuf[count], used < i ? nodes[used] : NULL);
+    spin_unlock(&entry_node->sp);
+
+    for (; used < i; used++)
+      discard_node(entry_node, nodes[used]);
+    vfree(nodes);
+
+    if (count == 0)
+      count = -ENOMEM;
+  }
+
+  vfree(kbuf);
+  return count;
+}
+
+static ssize_t stats_read(struct file *filp, char __user *buf, size_t len, loff_t *off) {
+  char statsbuffer[BUFFER_LENGTH];
+  ssize_t buf_length = 0;
+
+  if ((*off) > 0) /* Tell the application that there is nothing left to read */
+    return 0;
+
+  buf_length += sprintf(statsbuffer, "items_in_use=%d\n", atomic_read(&items_in_use));
+  buf_length += sprintf(statsbuffer + buf_length, "sorted_items_in_use=%d\n", atomic_read(&sorted_in_use));
+  buf_length += sprintf(statsbuffer + buf_length, "chunks_in_use=%d\n", atomic_read(&chunks_in_use));
+
+  if (len < buf_length)
+    return -ENOSPC;
+
+  /* Transfer data from the kernel to userspace  */
+  if (copy_to_user(buf, statsbuffer, buf_length))
+    return -EFAULT;
+
+  (*off)+=buf_length;  /* Update the file pointer */
+
+  return buf_length;
+}
+
+static list_item_t* alloc_item(int data) {
+  list_item_t *item = kmem_cache_alloc(item_cache, GFP_KERNEL);
+
+  if (item == NULL)
+    return NULL;
+
+  item->data = data;
+  atomic_inc(&items_in_use);
+
+  return item;
+}
+
+static void free_item_rcu(struct rcu_head *head) {
+  list_item_t *item = container_of(head, list_item_t, rcu);
+
+  kmem_cache_free(item_cache, item);
+  atomic_dec(&items_in_use);
+}
+
+/* Releases a node already unlinked with list_del_rcu(), once no reader can see it */
+static void free_item(list_item_t *item) {
+  call_rcu(&item->rcu, free_item_rcu);
+}
+
+/* kmem_cache_destroy() ignores the caches that weren't created */
+static void destroy_caches(void) {
+  kmem_cache_destroy(item_cache);
+  kmem_cache_destroy(sorted_cache);
+  kmem_cache_destroy(chunk_cache);
+}
+
+/* Nodes from alloc_node() that are enough to add 'nr_adds' elements */
+static unsigned int nodes_needed(entry_list_node_t *entry_node, unsigned int nr_adds) {
+  if (entry_node->mode == MODE_CHUNKED)
+    return DIV_ROUND_UP(nr_adds, CHUNK_CAPACITY);
+  return nr_adds;
+}
+
+static void* alloc_node(entry_list_node_t *entry_node) {
+  sorted_item_t *sitem;
+  chunk_t *chunk;
+
+  switch (entry_node->mode) {
+  case MODE_SORTED:
+    sitem = kmem_cache_alloc(sorted_cache, GFP_KERNEL);
+    if (sitem != NULL)
+      atomic_inc(&sorted_in_use);
+    return sitem;
+  case MODE_CHUNKED:
+    chunk = kmem_cache_alloc(chunk_cache, GFP_KERNEL);
+    if (chunk != NULL)
+      atomic_inc(&chunks_in_use);
+    return chunk;
+  default:
+    return alloc_item(0);
+  }
+}
+
+/* Releases a node from alloc_node() that is no longer linked into the entry.
+*  Readers of MODE_LIST entries may still see it: use free_item() for those */
+static void discard_node(entry_list_node_t *entry_node, void *node) {
+  switch (entry_node->mode) {
+  case MODE_SORTED:
+    kmem_cache_free(sorted_cache, node);
+    atomic_dec(&sorted_in_use);
+    break;
+  case MODE_CHUNKED:
+    kmem_cache_free(chunk_cache, node);
+    atomic_dec(&chunks_in_use);
+    break;
+  default:
+    kmem_cache_free(item_cache, node);
+    atomic_dec(&items_in_use);
+    break;
+  }
+}
+
+/* Adds 'num' to the entry, using 'node' (from alloc_node()) if needed.
+*  Returns 1 if the node was used and 0 otherwise. Call with the entry lock held */
+static int entry_add(entry_list_node_t *entry_node, int num, void *node) {
+  list_item_t *item;
+  sorted_item_t *sitem;
+  chunk_t *chunk;
+  struct rb_node **link, *parent = NULL;
+
+  if (entry_node->mode == MODE_LIST) {
+    item = node;
+    item->data = num;
+    list_add_tail_rcu(&item->links, &entry_node->list);
+    return 1;
+  }
+
+  if (entry_node->mode == MODE_CHUNKED) {
+    /* Appending doesn't move any element: saved cursors stay valid */
+    if (!list_empty(&entry_node->list)) {
+      chunk = list_last_entry(&entry_node->list, chunk_t, links);
+      if (chunk->nr < CHUNK_CAPACITY) {
+        chunk->data[chunk->nr++] = num;
+        return 0;
+      }
+    }
+    chunk = node;
+    chunk->nr = 1;
+    chunk->data[0] = num;
+    list_add_tail(&chunk->links, &entry_node->list);
+    return 1;
+  }
+
+  /* Positions after the new element shift by one */
+  bump_gen(entry_node);
+
+  link = &entry_node->tree.rb_node;
+  while (*link) {
+    parent = *link;
+    sitem = rb_entry(parent, sorted_item_t, node);
+    if (num < sitem->data)
+      link = &parent->rb_left;
+    else if (num > sitem->data)
+      link = &parent->rb_right;
+    else {
+      sitem->count++;
+      return 0;
+    }
+  }
+
+  sitem = node;
+  sitem->data = num;
+  sitem->count = 1;
+  rb_link_node(&sitem->node, parent, link);
+  rb_insert_color(&sitem->node, &entry_node->tree);
+  return 1;
+}
+
+/* Removes every copy of 'num'. Call with the entry lock held */
+static void entry_remove(entry_list_node_t *entry_node, int num) {
+  list_item_t *pos, *temp;
+  sorted_item_t *sitem;
+  chunk_t *src, *dst, *ctemp;
+  struct rb_node *node;
+  unsigned int i, n, d = 0;
+
+  bump_gen(entry_node);
+
+  if (entry_node->mode == MODE_LIST) {
     list_for_each_entry_safe(pos, temp, &entry_node->list, links) {
-        list_del(&pos->links);
-        vfree(pos);
+      if (pos->data == num) {
+        list_del_rcu(&pos->links);
+        free_item(pos);
+      }
     }
-    spin_unlock(&entry_node->sp);
+    return;
+  }
+
+  if (entry_node->mode == MODE_CHUNKED) {
+    if (list_empty(&entry_node->list))
+      return;
+
+    /* Move the elements that stay towards the head in a single pass */
+    dst = list_first_entry(&entry_node->list, chunk_t, links);
+    list_for_each_entry(src, &entry_node->list, links) {
+      n = src->nr;
+      for (i = 0; i < n; i++) {
+        if (src->data[i] == num)
+          continue;
+        if (d == CHUNK_CAPACITY) {
+          dst->nr = d;
+          dst = list_next_entry(dst, links);
+          d = 0;
+        }
+        dst->data[d++] = src->data[i];
+      }
+    }
+    dst->nr = d;
 
+    /* Release the chunks left empty at the tail */
+    src = dst;
+    list_for_each_entry_safe_continue(src, ctemp, &entry_node->list, links) {
+      list_del(&src->links);
+      discard_node(entry_node, src);
+    }
+    if (dst->nr == 0) {
+      list_del(&dst->links);
+      discard_node(entry_node, dst);
+    }
+    return;
   }
 
-  (*off)+=len; /* Update the file pointer */
+  node = entry_node->tree.rb_node;
+  while (node) {
+    sitem = rb_entry(node, sorted_item_t, node);
+    if (num < sitem->data)
+      node = node->rb_left;
+    else if (num > sitem->data)
+      node = node->rb_right;
+    else {
+      /* Readers of sorted entries hold the lock: no grace period needed */
+      rb_erase(&sitem->node, &entry_node->tree);
+      discard_node(entry_node, sitem);
+      return;
+    }
+  }
+}
 
-  return len;
+/* Removes every element. Call with the entry lock held */
+static void entry_cleanup(entry_list_node_t *entry_node) {
+  list_item_t *pos, *temp;
+  sorted_item_t *sitem, *stemp;
+  chunk_t *chunk, *ctemp;
+
+  bump_gen(entry_node);
+
+  switch (entry_node->mode) {
+  case MODE_LIST:
+    list_for_each_entry_safe(pos, temp, &entry_node->list, links) {
+      list_del_rcu(&pos->links);
+      free_item(pos);
+    }
+    break;
+  case MODE_SORTED:
+    rbtree_postorder_for_each_entry_safe(sitem, stemp, &entry_node->tree, node)
+      discard_node(entry_node, sitem);
+    entry_node->tree = RB_ROOT;
+    break;
+  case MODE_CHUNKED:
+    list_for_each_entry_safe(chunk, ctemp, &entry_node->list, links) {
+      list_del(&chunk->links);
+      discard_node(entry_node, chunk);
+    }
+    break;
+  }
 }
 
 
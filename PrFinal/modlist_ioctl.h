@@ -0,0 +1,32 @@
+#ifndef MODLIST_IOCTL_H
+#define MODLIST_IOCTL_H
+
+/* Binary interface of the /proc/multilist/<name> entries, shared by the
+*  module and the userspace programs */
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Argument of MODLIST_IOC_EXPORT and MODLIST_IOC_IMPORT */
+struct modlist_ioc_buf {
+    __u64 data;      /* user address of a packed array of int32 */
+    __u32 nr_items;  /* number of elements (or room) in 'data' */
+    __u32 offset;    /* EXPORT only: position of the first element to copy */
+};
+
+#define MODLIST_IOC_MAGIC 'l'
+
+/* Copies up to nr_items elements, starting at 'offset', into 'data'.
+*  Returns the number of elements copied (0 when 'offset' is past the end).
+*  A call whose 'offset' is where the previous one on the same file stopped
+*  resumes there, so paging through the list costs a single walk */
+#define MODLIST_IOC_EXPORT _IOW(MODLIST_IOC_MAGIC, 1, struct modlist_ioc_buf)
+/* Appends the nr_items elements of 'data' at the end of the list.
+*  Returns the number of elements added */
+#define MODLIST_IOC_IMPORT _IOW(MODLIST_IOC_MAGIC, 2, struct modlist_ioc_buf)
+/* Returns the number of elements in the list */
+#define MODLIST_IOC_COUNT _IO(MODLIST_IOC_MAGIC, 3)
+
+/* Max elements moved by a single EXPORT/IMPORT call */
+#define MODLIST_IOC_MAX_ITEMS (1 << 20)
+
+#endif